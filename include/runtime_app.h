@@ -33,12 +33,20 @@
 
 #if ! defined( DISABLE_RUNTIME_COMPILATION ) && ! defined( DISABLE_RUNTIME_COMPILED_APP )
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
 #include "cinder/Exception.h"
 #include "cinder/Filesystem.h"
+#include "cinder/Log.h"
 #include "cinder/System.h"
 #include "cinder/Utilities.h"
 #include "cling/Interpreter/Interpreter.h"
-#include "Watchdog.h"
+#include "runtime_compiler.h"
+#include "runtime_interpreter.h"
+#include "runtime_source.h"
+#include "runtime_watcher.h"
 
 class runtime_app;
 
@@ -192,19 +200,65 @@ public:
 
 class runtime_app : public ci::app::App {
 public:
-	runtime_app(){}
+	runtime_app() : mSourceHash( 0 ), mNumSkippedReloads( 0 ), mFastTierLatency( 0.0 ), mOptimizedTierLatency( 0.0 ), mHasPending( false ), mCompileFailed( false ), mNumFailedCompilations( 0 ) {}
 	virtual ~runtime_app(){}
 	
+	class Options {
+	public:
+		Options() : mCoalescingWindow( 0.1 ), mOptimizationLevel( runtime::getDefaultOptimizationLevel() ), mTieredCompilation( false ), mStandard( "c++11" ) {}
+		
+		//! Specifies how long to wait for the file to stop changing before recompiling it. Defaults to 0.1 seconds
+		Options& coalescingWindow( double seconds ) { mCoalescingWindow = seconds; return *this; }
+		//! Specifies the optimization level of the jit-compiled code. Defaults to 2 in release and 0 in debug
+		Options& optimizationLevel( int level ) { mOptimizationLevel = level; return *this; }
+		//! Specifies the language standard passed to the interpreter. Defaults to "c++11"
+		Options& standard( const std::string &standard ) { mStandard = standard; return *this; }
+		//! Adds flags to the interpreter command line, ie. "-march=native -ffast-math"
+		Options& compilerFlags( const std::string &flags ) { mCompilerFlags.push_back( flags ); return *this; }
+		//! Swaps an unoptimized version of the code as soon as possible, then the version compiled with the optimization level once it's ready
+		Options& tieredCompilation( bool tiered = true ) { mTieredCompilation = tiered; return *this; }
+		//! Adds a header to the precompiled header loaded by the interpreter, ie. "cinder/gl/gl.h". The precompiled header is cached on disk and rebuilt when one of its files changes
+		Options& precompiledHeader( const std::string &header ) { mPrecompiledHeaders.push_back( header ); return *this; }
+		
+		double getCoalescingWindow() const { return mCoalescingWindow; }
+		int getOptimizationLevel() const { return mOptimizationLevel; }
+		const std::string& getStandard() const { return mStandard; }
+		const std::vector<std::string>& getCompilerFlags() const { return mCompilerFlags; }
+		bool isTieredCompilationEnabled() const { return mTieredCompilation; }
+		const std::vector<std::string>& getPrecompiledHeaders() const { return mPrecompiledHeaders; }
+		
+	protected:
+		double mCoalescingWindow;
+		int mOptimizationLevel;
+		bool mTieredCompilation;
+		std::string mStandard;
+		std::vector<std::string> mCompilerFlags;
+		std::vector<std::string> mPrecompiledHeaders;
+	};
+	
+	//! Returns the number of reloads that were skipped because the code didn't change since the last successful compilation
+	size_t getNumSkippedReloads() const { return mNumSkippedReloads; }
+	//! Returns the time in seconds between the start of the last compilation and the swap of its unoptimized version
+	double getFastTierLatency() const { return mFastTierLatency; }
+	//! Returns the time in seconds between the start of the last compilation and the swap of its optimized version
+	double getOptimizedTierLatency() const { return mOptimizedTierLatency; }
+	//! Emitted on the main thread when a new version of the app fails to compile, with the errors reported by the interpreter. The app keeps running the last version that compiled
+	ci::signals::Signal<void(const std::vector<runtime::Diagnostic>&)>& getSignalCompileFailed() { return mSignalCompileFailed; }
+	//! Returns the diagnostics reported by the interpreter during the last compilation
+	std::vector<runtime::Diagnostic> getDiagnostics() const { std::lock_guard<std::mutex> lock( mDiagnosticsMutex ); return mDiagnostics; }
+	//! Returns the number of compilations that failed
+	size_t getNumFailedCompilations() const { return mNumFailedCompilations; }
+	
 	//! \cond
 	// Called during application instanciation via CINDER_APP_MAC macro
 	template<typename AppT>
-	static void main( const ci::app::RendererRef &defaultRenderer, const char *title, int argc, char * const argv[], const std::string &file, const SettingsFn &settingsFn = SettingsFn(), const std::function<void(cling::Interpreter *)> &runtimeSettingsFn = std::function<void(cling::Interpreter *)>() );
+	static void main( const ci::app::RendererRef &defaultRenderer, const char *title, int argc, char * const argv[], const std::string &file, const SettingsFn &settingsFn = SettingsFn(), const std::function<void(cling::Interpreter *)> &runtimeSettingsFn = std::function<void(cling::Interpreter *)>(), const Options &options = Options() );
 	//! \endcond
 	
 	//! Override to perform any application setup after the Renderer has been initialized.
 	virtual void	setup() { if( mRuntimeImpl ) mRuntimeImpl->setup(); }
 	//! Override to perform any once-per-loop computation.
-	virtual void	update() { if( mRuntimeImpl ) mRuntimeImpl->update(); }
+	virtual void	update() { applyPending(); reportCompileFailure(); if( mRuntimeImpl ) mRuntimeImpl->update(); }
 	//! Override to perform any rendering once-per-loop or in response to OS-prompted requests for refreshes.
 	virtual void	draw() { if( mRuntimeImpl ) mRuntimeImpl->draw(); else ci::gl::clear(); }
 	
@@ -239,10 +293,122 @@ public:
 	virtual void	cleanup() { if( mRuntimeImpl ) mRuntimeImpl->cleanup(); }
 
 protected:
+	
+	template<typename AppT>
+	static bool declareGeneration( cling::Interpreter *interpreter, runtime_app *runtimeApp, const std::string &includesString, std::string code, uint64_t sourceHash, int optimizationLevel, bool optimizedTier, const std::chrono::steady_clock::time_point &startTime );
+	//! Switches the app to the last generation published by the compile thread. Called on the main thread at the start of each frame
+	void applyPending();
+	//! Emits the failure of the last compilation if it hasn't been reported yet
+	void reportCompileFailure();
 
 	std::shared_ptr<RuntimeAppWrapper> mRuntimeImpl;
+	// layout of the class of mRuntimeImpl. Only used on the main thread
+	runtime::ClassLayout mLayout;
+	
+	// hash of the code of the last successful compilation. Only used on the compile thread
+	uint64_t mSourceHash;
+	std::atomic<size_t> mNumSkippedReloads;
+	std::atomic<double> mFastTierLatency, mOptimizedTierLatency;
+	
+	// generation compiled on the compile thread, waiting for the main thread to create the new instance
+	typedef void (*FactoryFn)( void* );
+	struct Generation {
+		Generation() : mFactory( nullptr ), mOptimizedTier( false ) {}
+		// fills a std::shared_ptr<RuntimeAppWrapper> with a new instance of the generation
+		FactoryFn								mFactory;
+		runtime::ClassLayout					mLayout;
+		std::vector<void*>						mVTables;
+		// an optimized tier only switches the methods of the current instance, it isn't created and set up again
+		bool									mOptimizedTier;
+		std::chrono::steady_clock::time_point	mStartTime;
+	};
+	std::mutex mPendingMutex;
+	Generation mPending;
+	bool mHasPending;
+	
+	// diagnostics of the last compilation, a failure is reported by the next update unless a newer version compiled meanwhile
+	mutable std::mutex mDiagnosticsMutex;
+	std::vector<runtime::Diagnostic> mDiagnostics;
+	bool mCompileFailed;
+	std::atomic<size_t> mNumFailedCompilations;
+	ci::signals::Signal<void(const std::vector<runtime::Diagnostic>&)> mSignalCompileFailed;
 };
 
+inline void runtime_app::applyPending()
+{
+	Generation generation;
+	{
+		std::lock_guard<std::mutex> lock( mPendingMutex );
+		if( ! mHasPending ) {
+			return;
+		}
+		generation = mPending;
+		mHasPending = false;
+	}
+	
+	// the optimized version of the code the app is already running only needs new methods, the instance keeps its state
+	// and resources and setup isn't called again
+	double latency = std::chrono::duration<double>( std::chrono::steady_clock::now() - generation.mStartTime ).count();
+	if( generation.mOptimizedTier ) {
+		if( mRuntimeImpl && generation.mLayout == mLayout && ! generation.mVTables.empty() && generation.mVTables.size() == mLayout.mVTablePointers.size() ) {
+			char *bytes = reinterpret_cast<char*>( mRuntimeImpl.get() );
+			for( size_t i = 0; i < generation.mVTables.size(); ++i ) {
+				*reinterpret_cast<void**>( bytes + mLayout.mVTablePointers[i] ) = generation.mVTables[i];
+			}
+			mOptimizedTierLatency = latency;
+		}
+		else {
+			CI_LOG_W( "The optimized version of the app can't be swapped in place, the unoptimized version is kept" );
+		}
+		return;
+	}
+	
+	std::shared_ptr<RuntimeAppWrapper> newImpl;
+	if( generation.mFactory ) {
+		generation.mFactory( &newImpl );
+	}
+	if( ! newImpl ) {
+		return;
+	}
+	
+#ifdef RUNTIME_APP_CEREALIZATION
+	bool cerealized = false;
+	std::stringstream archiveStream;
+	if( mRuntimeImpl ) {
+		cereal::BinaryOutputArchive outputArchive( archiveStream );
+		mRuntimeImpl->save( outputArchive );
+		cerealized = true;
+	}
+#endif
+	
+	// the new instance is created and set up on the main thread, where the gl context is current
+	mRuntimeImpl = newImpl;
+	mRuntimeImpl->mParent = this;
+	mLayout = generation.mLayout;
+	setup();
+#ifdef RUNTIME_APP_CEREALIZATION
+	if( cerealized ) {
+		cereal::BinaryInputArchive inputArchive( archiveStream );
+		mRuntimeImpl->load( inputArchive );
+	}
+#endif
+	mFastTierLatency = latency;
+}
+
+inline void runtime_app::reportCompileFailure()
+{
+	std::vector<runtime::Diagnostic> diagnostics;
+	{
+		std::lock_guard<std::mutex> lock( mDiagnosticsMutex );
+		if( ! mCompileFailed ) {
+			return;
+		}
+		diagnostics = mDiagnostics;
+		mCompileFailed = false;
+	}
+	mSignalCompileFailed.emit( diagnostics );
+}
+
 ci::app::WindowRef	RuntimeAppWrapper::createWindow( const ci::app::Window::Format &format )
 {
 	return mParent->createWindow( format );
@@ -435,20 +601,37 @@ ci::app::RendererRef RuntimeAppWrapper::getDefaultRenderer() const
 }
 
 template<typename AppT>
-void runtime_app::main( const ci::app::RendererRef &defaultRenderer, const char *title, int argc, char * const argv[], const std::string &file, const SettingsFn &settingsFn, const std::function<void(cling::Interpreter *)> &runtimeSettingsFn )
+void runtime_app::main( const ci::app::RendererRef &defaultRenderer, const char *title, int argc, char * const argv[], const std::string &file, const SettingsFn &settingsFn, const std::function<void(cling::Interpreter *)> &runtimeSettingsFn, const Options &options )
 {
 	// init interpreter
 	// initialize cling interpreter
-	const char * args[] = { "-std=c++11", "-Wno-inconsistent-missing-override" };
+	auto args = runtime::getCompilerArgs( options.getStandard(), options.getOptimizationLevel(), options.getCompilerFlags() );
+	args.push_back( "-Wno-inconsistent-missing-override" );
+	auto path = ci::fs::path( file );
 	auto blockPath = ci::fs::path( __FILE__ ).parent_path().parent_path();
-	auto interpreter = new cling::Interpreter( 2, args, ( blockPath.string() + "/lib/" ).c_str() );
+	
+	// parse cinder and the other common headers once and for all
+	if( ! options.getPrecompiledHeaders().empty() ) {
+		args.push_back( "-DGLM_COMPILER=0" );
+		std::vector<ci::fs::path> includePaths = { path.parent_path().parent_path() / "include", blockPath / "include", runtime::getCinderIncludePath() };
+		auto pchPath = runtime::getPrecompiledHeader( options.getPrecompiledHeaders(), args, includePaths );
+		if( ! pchPath.empty() ) {
+			args.push_back( "-include-pch" );
+			args.push_back( pchPath.string() );
+		}
+	}
+	
+	std::vector<const char*> interpreterArgs;
+	for( const auto &arg : args ) {
+		interpreterArgs.push_back( arg.c_str() );
+	}
+	auto interpreter = new cling::Interpreter( interpreterArgs.size(), interpreterArgs.data(), ( blockPath.string() + "/lib/" ).c_str() );
+	interpreter->setDefaultOptLevel( options.getOptimizationLevel() );
 	
 	// add the parent path to the include paths
-	auto path = ci::fs::path( file );
 	interpreter->AddIncludePath( path.parent_path().string() );
 	interpreter->AddIncludePath( ( path.parent_path().parent_path() / "include" ).string() );
 	interpreter->AddIncludePath( ( blockPath / "include" ).string() );
-	interpreter->AddIncludePath( ( blockPath / "../Watchdog/include" ).string() );
 	
 	// add cinder
 	interpreter->declare( "#define GLM_COMPILER 0" );
@@ -465,21 +648,9 @@ void runtime_app::main( const ci::app::RendererRef &defaultRenderer, const char
 	}
 	
 	// compile the original class
-	// copy the file content to a string
-	std::string originalCode;
-	std::ifstream infile( path.c_str() );
-	std::string line;
-	std::vector<std::string> includes;
-	while( std::getline( infile, line ) ) {
-		if( line.find( "CINDER_RUNTIME_APP" ) != std::string::npos ) {
-			break;
-		}
-		//if( line.find( "#include \"runtime_app.h\"" ) == std::string::npos ) {
-		if( line.find( "#include" ) == std::string::npos ) {
-			originalCode += line + " \n";
-		}
-		else includes.push_back( line );
-	}
+	auto source = runtime::SourceAssembler::get().assembleApp( path );
+	std::string originalCode = source.mCode;
+	const std::string &includesString = source.mIncludesString;
 	
 	// make the App inherit from AppBase instead of App
 	size_t pos = 0;
@@ -488,12 +659,6 @@ void runtime_app::main( const ci::app::RendererRef &defaultRenderer, const char
 		originalCode.replace( pos, std::string( "public App" ).length(), wrapperApp );
 		pos += wrapperApp.length();
 	}
-	// prepend the includes
-	std::string includesString;
-	for( auto inc : includes ) {
-		includesString += inc + "\n";
-	}
-	
 	// wrap original code in its own namespace
 	originalCode = includesString + "\n\nnamespace RuntimeBase {\n" + originalCode + "\n};";
 	//std::cout << "Original Code " << std::endl << originalCode << std::endl << std::endl;
@@ -518,91 +683,41 @@ void runtime_app::main( const ci::app::RendererRef &defaultRenderer, const char
 	
 	runtime_app *runtimeApp = new runtime_app();
 	
-	// watch cpp
-	std::string className = ci::System::demangleTypeName( typeid( AppT ).name() );
-	wd::watch( path, [path,className,interpreter,runtimeApp]( const ci::fs::path& ) {
-		// copy the file content to a string
-		std::string code;
-		
-		std::ifstream infile( path.c_str() );
-		std::string line;
-		std::vector<std::string> includes;
-		while( std::getline( infile, line ) ) {
-			if( line.find( "CINDER_RUNTIME_APP" ) != std::string::npos ) {
-				break;
+	// watch cpp, the file is recompiled on the compile thread once the burst of events
+	// editors usually generate when saving a file is over
+	double coalescingWindow = options.getCoalescingWindow();
+	runtime::WatchService::get().watch( { path }, [path,interpreter,runtimeApp,coalescingWindow,options]( const std::vector<ci::fs::path>& ) {
+		runtime::CompileWorker::get().enqueue( path.string(), coalescingWindow, [path,interpreter,runtimeApp,options]() {
+			// the app is quitting, don't start a compilation that would delay it
+			if( runtime::CompileWorker::get().isStopping() ) {
+				return;
 			}
-			if( line.find( "#include" ) == std::string::npos ) {
-				code += line + " \n";
+			
+			// split the includes from the code, only the parts of the file that changed are split again
+			auto source = runtime::SourceAssembler::get().assembleApp( path );
+			const std::string &includesString = source.mIncludesString;
+			const std::string &code = source.mCode;
+			
+			// skip the reload if the file was saved without any actual change
+			uint64_t sourceHash = runtime::hash( includesString + code );
+			if( sourceHash == runtimeApp->mSourceHash ) {
+				runtimeApp->mNumSkippedReloads++;
+				return;
 			}
-			else includes.push_back( line );
-		}
-		
-		// prepend the includes
-		std::string includesString;
-		for( auto inc : includes ) {
-			includesString += inc + "\n";
-		}
-		
-		// make a unique namespace name
-		std::string uniqueNamespace;
-		interpreter->createUniqueName( uniqueNamespace );
-		uniqueNamespace = className + uniqueNamespace;
-		
-		// wrap the code in its own unique namespace
-		code = includesString + "\n\nnamespace " + uniqueNamespace + " {\n" + code + "\n};";
-		
-		// Make the class inherit from the original one
-		std::string classLineToken = "class " + className + " : public App";
-		size_t pos = code.find( classLineToken );
-		if( pos != std::string::npos ) {
-			code.replace( pos, classLineToken.length(), "class " + className + " : public RuntimeBase::" + className + " " );
-		}
-		//std::cout << code << std::endl;
-		
-		// process the new code
-		interpreter->enableRawInput();
-		interpreter->declare( code );
-		interpreter->enableRawInput( false );
-		
-#ifdef RUNTIME_APP_CEREALIZATION
-		bool cerealized = false;
-		std::stringstream archiveStream;
-#endif
-		
-		// if the instance already exists override it
-		std::string instanceName = "runtime_App";
-		std::string scopedClassName = "RuntimeBase::" + className;
-		std::string scopedRuntimeClassName = uniqueNamespace + "::" + className;
-		if( interpreter->getAddressOfGlobal( instanceName ) ) {
-#ifdef RUNTIME_APP_CEREALIZATION
-			cereal::BinaryOutputArchive outputArchive( archiveStream );
-			if( runtimeApp->mRuntimeImpl ) {
-				runtimeApp->mRuntimeImpl->save( outputArchive );
-				cerealized = true;
+			
+			// with tiered compilation the new code is first compiled without optimizations to be swapped as soon as
+			// possible, then recompiled with the requested optimization level and swapped again
+			auto startTime = std::chrono::steady_clock::now();
+			bool tiered = options.isTieredCompilationEnabled() && options.getOptimizationLevel() > 0;
+			if( declareGeneration<AppT>( interpreter, runtimeApp, includesString, code, sourceHash, tiered ? 0 : options.getOptimizationLevel(), false, startTime ) && tiered ) {
+				runtime::CompileWorker::get().enqueue( path.string() + ":optimized", 0.0, [interpreter,runtimeApp,includesString,code,sourceHash,startTime,options]() {
+					// no need to optimize code that has already been replaced by a newer version
+					if( sourceHash == runtimeApp->mSourceHash && ! runtime::CompileWorker::get().isStopping() ) {
+						declareGeneration<AppT>( interpreter, runtimeApp, includesString, code, sourceHash, options.getOptimizationLevel(), true, startTime );
+					}
+				} );
 			}
-#endif
-			interpreter->process( instanceName + " = std::make_shared<" + scopedRuntimeClassName + ">();" );
-		}
-		// otherwise create it
-		else {
-			interpreter->process( "std::shared_ptr<" + scopedClassName + "> " + instanceName + " = std::make_shared<" + scopedRuntimeClassName + ">();" );
-		}
-		
-		// grab the new address and update the runtime_ptr instance
-		if( auto address = interpreter->getAddressOfGlobal( instanceName ) ) {
-			auto newImpl = *reinterpret_cast<std::shared_ptr<RuntimeAppWrapper>*>( address );
-			if( newImpl ) {
-				runtimeApp->mRuntimeImpl = newImpl;
-				runtimeApp->mRuntimeImpl->mParent = runtimeApp;
-				runtimeApp->setup();
-#ifdef RUNTIME_APP_CEREALIZATION
-				if( cerealized ) {
-					cereal::BinaryInputArchive inputArchive( archiveStream );
-					runtimeApp->mRuntimeImpl->load( inputArchive );
-				}
-#endif
-			}
-		}
+		} );
 	} );
 	
 	runtimeApp->executeLaunch();
@@ -611,6 +726,76 @@ void runtime_app::main( const ci::app::RendererRef &defaultRenderer, const char
 	ci::app::AppBase::cleanupLaunch();
 }
 
+template<typename AppT>
+bool runtime_app::declareGeneration( cling::Interpreter *interpreter, runtime_app *runtimeApp, const std::string &includesString, std::string code, uint64_t sourceHash, int optimizationLevel, bool optimizedTier, const std::chrono::steady_clock::time_point &startTime )
+{
+	std::string className = ci::System::demangleTypeName( typeid( AppT ).name() );
+	
+	// make a unique namespace name
+	std::string uniqueNamespace;
+	interpreter->createUniqueName( uniqueNamespace );
+	uniqueNamespace = className + uniqueNamespace;
+	
+	// wrap the code in its own unique namespace
+	code = includesString + "\n\nnamespace " + uniqueNamespace + " {\n" + code + "\n};";
+	
+	// Make the class inherit from the original one
+	std::string classLineToken = "class " + className + " : public App";
+	size_t pos = code.find( classLineToken );
+	if( pos != std::string::npos ) {
+		code.replace( pos, classLineToken.length(), "class " + className + " : public RuntimeBase::" + className + " " );
+	}
+	//std::cout << code << std::endl;
+	
+	// the instances are created on the main thread through a native entry point declared with the class
+	std::string factoryName = "runtimeCreate" + uniqueNamespace;
+	code += "\n\nextern \"C\" void " + factoryName + "( void *instance ) {\n"
+		"\t*static_cast<std::shared_ptr<RuntimeAppWrapper>*>( instance ) = std::make_shared<" + uniqueNamespace + "::" + className + ">();\n"
+		"}";
+	
+	// process the new code
+	cling::Interpreter::CompilationResult result;
+	std::vector<runtime::Diagnostic> diagnostics;
+	{
+		runtime::ScopedDiagnostics scopedDiagnostics( interpreter );
+		interpreter->setDefaultOptLevel( optimizationLevel );
+		interpreter->enableRawInput();
+		result = interpreter->declare( code );
+		interpreter->enableRawInput( false );
+		diagnostics = scopedDiagnostics.getDiagnostics();
+	}
+	
+	// a failed declaration leaves nothing to instantiate, the current instance is kept as is instead of being set up again
+	bool compiled = result == cling::Interpreter::kSuccess;
+	{
+		std::lock_guard<std::mutex> lock( runtimeApp->mDiagnosticsMutex );
+		runtimeApp->mDiagnostics = diagnostics;
+		runtimeApp->mCompileFailed = ! compiled;
+	}
+	if( ! compiled ) {
+		runtimeApp->mNumFailedCompilations++;
+		return false;
+	}
+	runtimeApp->mSourceHash = sourceHash;
+	
+	Generation generation;
+	generation.mFactory = reinterpret_cast<FactoryFn>( interpreter->getAddressOfGlobal( factoryName ) );
+	generation.mLayout = runtime::getClassLayout( interpreter, uniqueNamespace + "::" + className );
+	generation.mVTables = runtime::getVTables( interpreter, generation.mLayout );
+	generation.mOptimizedTier = optimizedTier;
+	generation.mStartTime = startTime;
+	
+	// publish the generation, the main thread swaps it at the start of the next frame
+	std::lock_guard<std::mutex> lock( runtimeApp->mPendingMutex );
+	if( runtimeApp->mHasPending && ! runtimeApp->mPending.mOptimizedTier ) {
+		// the unoptimized generation hasn't been applied yet, the optimized one replaces it and is created like it would have been
+		generation.mOptimizedTier = false;
+	}
+	runtimeApp->mPending = generation;
+	runtimeApp->mHasPending = true;
+	return compiled;
+}
+
 #define CINDER_RUNTIME_APP( APP, RENDERER, ... )										\
 int main( int argc, char* argv[] )											\
 {																					\
@@ -0,0 +1,411 @@
+/*
+ Cinder-Runtime
+ Compiler
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cinder/Filesystem.h"
+#include "cinder/Log.h"
+
+namespace runtime {
+
+//! Returns a 64-bit FNV-1a hash of \a source, used to detect whether the code actually changed between two saves
+inline uint64_t hash( const std::string &source )
+{
+	uint64_t result = 14695981039346656037ull;
+	for( const char c : source ) {
+		result ^= static_cast<unsigned char>( c );
+		result *= 1099511628211ull;
+	}
+	return result;
+}
+
+//! Returns the default optimization level of the runtime code, matching the configuration of the app
+inline int getDefaultOptimizationLevel()
+{
+#if defined(NDEBUG) || defined(_NDEBUG) || defined(RELEASE) || defined(MASTER) || defined(GOLD)
+	return 2;
+#else
+	return 0;
+#endif
+}
+
+//! Returns the arguments used to construct an interpreter. \a flags are split on whitespaces
+inline std::vector<std::string> getCompilerArgs( const std::string &standard, int optimizationLevel, const std::vector<std::string> &flags )
+{
+	std::vector<std::string> args = { "-std=" + standard, "-O" + std::to_string( optimizationLevel ) };
+	for( const auto &flag : flags ) {
+		std::istringstream stream( flag );
+		std::string arg;
+		while( stream >> arg ) {
+			args.push_back( arg );
+		}
+	}
+	return args;
+}
+
+//! Returns the root folder of the block
+inline ci::fs::path getBlockPath()
+{
+	return ci::fs::path( __FILE__ ).parent_path().parent_path();
+}
+
+//! Returns Cinder's include folder
+inline ci::fs::path getCinderIncludePath()
+{
+	return getBlockPath().parent_path().parent_path() / "include";
+}
+
+//! Returns whether \a outputPath is newer than every file listed in the dependency file at \a depsPath
+inline bool isUpToDate( const ci::fs::path &outputPath, const ci::fs::path &depsPath )
+{
+	if( ! ci::fs::exists( outputPath ) || ! ci::fs::exists( depsPath ) ) {
+		return false;
+	}
+	
+	// the dependency file uses the makefile syntax, ie. "target.pch: dep1.h dep2.h \" with escaped spaces
+	auto outputTime = ci::fs::last_write_time( outputPath );
+	std::ifstream depsFile( depsPath.c_str() );
+	std::string token, dependency;
+	bool target = true;
+	while( depsFile >> token ) {
+		if( token == "\\" ) {
+			continue;
+		}
+		// paths with spaces are split on several tokens
+		if( token.back() == '\\' ) {
+			dependency += token.substr( 0, token.size() - 1 ) + " ";
+			continue;
+		}
+		dependency += token;
+		if( target ) {
+			target = dependency.back() != ':';
+		}
+		else if( ! ci::fs::exists( dependency ) || ci::fs::last_write_time( dependency ) > outputTime ) {
+			return false;
+		}
+		dependency.clear();
+	}
+	return ! target;
+}
+
+//! Compiles \a sourcePath to \a outputPath with the clang of the block, listing the files it depends on next to the output. \a mode is either "-x c++-header" or "-shared". Returns whether it succeeded
+inline bool compile( const std::string &mode, const ci::fs::path &sourcePath, const ci::fs::path &outputPath, const std::vector<std::string> &args, const std::vector<ci::fs::path> &includePaths )
+{
+	auto compilerPath = getBlockPath() / "lib" / "bin" / "clang++";
+	if( ! ci::fs::exists( compilerPath ) ) {
+		CI_LOG_W( "Can't find " << compilerPath << ", " << sourcePath << " won't be precompiled" );
+		return false;
+	}
+	
+	// the output is only accepted by an interpreter created with the same flags
+	auto depsPath = ci::fs::path( outputPath ).replace_extension( ".d" );
+	std::string command = "\"" + compilerPath.string() + "\" " + mode;
+	for( const auto &arg : args ) {
+		command += " \"" + arg + "\"";
+	}
+	for( const auto &path : includePaths ) {
+		command += " -I\"" + path.string() + "\"";
+	}
+	command += " -MD -MF \"" + depsPath.string() + "\" \"" + sourcePath.string() + "\" -o \"" + outputPath.string() + "\"";
+	if( std::system( command.c_str() ) != 0 ) {
+		CI_LOG_E( "Failed to precompile " << sourcePath );
+		ci::fs::remove( outputPath );
+		ci::fs::remove( depsPath );
+		return false;
+	}
+	return true;
+}
+
+//! Returns the name of the cached files built from \a source with \a args and \a includePaths
+inline std::string getCacheKey( const std::string &source, const std::vector<std::string> &args, const std::vector<ci::fs::path> &includePaths )
+{
+	std::string key = source;
+	for( const auto &arg : args ) {
+		key += "\n" + arg;
+	}
+	for( const auto &path : includePaths ) {
+		key += "\n" + path.string();
+	}
+	std::stringstream name;
+	name << std::hex << hash( key );
+	return name.str();
+}
+
+//! Returns the folder where precompiled headers and libraries are cached between runs of the app
+inline ci::fs::path getCachePath()
+{
+	return getBlockPath() / "cache";
+}
+
+//! Returns a precompiled header of \a headers that can be loaded by an interpreter created with \a args. The header is built if it's missing or older than one of the files it includes. Returns an empty path if it can't be built
+inline ci::fs::path getPrecompiledHeader( const std::vector<std::string> &headers, const std::vector<std::string> &args, const std::vector<ci::fs::path> &includePaths )
+{
+	// include all the headers from a single file
+	std::string source;
+	for( const auto &header : headers ) {
+		if( ! header.empty() && ( header.front() == '<' || header.front() == '"' ) ) {
+			source += "#include " + header + "\n";
+		}
+		else {
+			source += "#include \"" + header + "\"\n";
+		}
+	}
+	
+	// one precompiled header per set of headers and command line
+	auto name = getCacheKey( source, args, includePaths );
+	auto sourcePath = getCachePath() / ( name + ".h" );
+	auto pchPath = getCachePath() / ( name + ".pch" );
+	if( isUpToDate( pchPath, getCachePath() / ( name + ".d" ) ) ) {
+		return pchPath;
+	}
+	
+	ci::fs::create_directories( getCachePath() );
+	std::ofstream( sourcePath.c_str() ) << source;
+	if( ! compile( "-x c++-header", sourcePath, pchPath, args, includePaths ) ) {
+		return ci::fs::path();
+	}
+	return pchPath;
+}
+
+//! Dynamic libraries of the original code of the runtime classes, kept between runs of the app so the interpreter doesn't have to compile it again
+class ObjectCache {
+public:
+	static ObjectCache& get() { static ObjectCache cache; return cache; }
+	
+	//! Returns the library compiled from \a source with \a args or an empty path if it's missing or out of date. \a version should identify the interpreter that will load the library
+	ci::fs::path find( const std::string &source, const std::vector<std::string> &args, const std::vector<ci::fs::path> &includePaths, const std::string &version );
+	//! Compiles \a source to a library that the next call to find with the same arguments will return. Returns whether it succeeded
+	bool build( const std::string &source, const std::vector<std::string> &args, const std::vector<ci::fs::path> &includePaths, const std::string &version );
+	
+	//! Returns the number of libraries found in the cache
+	size_t getNumHits() const { return mNumHits; }
+	//! Returns the number of libraries missing from the cache or out of date
+	size_t getNumMisses() const { return mNumMisses; }
+	//! Returns the ratio of lookups that found a library in the cache
+	double getHitRate() const { size_t lookups = mNumHits + mNumMisses; return lookups ? static_cast<double>( mNumHits ) / lookups : 0.0; }
+	//! Returns the size of the cache folder in bytes, precompiled headers included
+	uintmax_t getSizeOnDisk() const;
+	
+protected:
+	ObjectCache() : mNumHits( 0 ), mNumMisses( 0 ) {}
+	ci::fs::path getLibraryPath( const std::string &source, const std::vector<std::string> &args, const std::vector<ci::fs::path> &includePaths, const std::string &version ) const;
+	
+	std::atomic<size_t> mNumHits, mNumMisses;
+};
+
+inline ci::fs::path ObjectCache::getLibraryPath( const std::string &source, const std::vector<std::string> &args, const std::vector<ci::fs::path> &includePaths, const std::string &version ) const
+{
+#if defined( __APPLE__ )
+	std::string extension = ".dylib";
+#else
+	std::string extension = ".so";
+#endif
+	return getCachePath() / ( getCacheKey( source + "\n" + version, args, includePaths ) + extension );
+}
+
+inline ci::fs::path ObjectCache::find( const std::string &source, const std::vector<std::string> &args, const std::vector<ci::fs::path> &includePaths, const std::string &version )
+{
+	auto libraryPath = getLibraryPath( source, args, includePaths, version );
+	if( isUpToDate( libraryPath, ci::fs::path( libraryPath ).replace_extension( ".d" ) ) ) {
+		mNumHits++;
+		return libraryPath;
+	}
+	mNumMisses++;
+	return ci::fs::path();
+}
+
+inline bool ObjectCache::build( const std::string &source, const std::vector<std::string> &args, const std::vector<ci::fs::path> &includePaths, const std::string &version )
+{
+	auto libraryPath = getLibraryPath( source, args, includePaths, version );
+	auto sourcePath = ci::fs::path( libraryPath ).replace_extension( ".cpp" );
+	ci::fs::create_directories( getCachePath() );
+	std::ofstream( sourcePath.c_str() ) << source;
+	
+	// the symbols of cinder and of the app are resolved when the interpreter loads the library
+#if defined( __APPLE__ )
+	return compile( "-shared -fPIC -undefined dynamic_lookup", sourcePath, libraryPath, args, includePaths );
+#else
+	return compile( "-shared -fPIC", sourcePath, libraryPath, args, includePaths );
+#endif
+}
+
+inline uintmax_t ObjectCache::getSizeOnDisk() const
+{
+	uintmax_t size = 0;
+	if( ci::fs::is_directory( getCachePath() ) ) {
+		for( ci::fs::directory_iterator it( getCachePath() ), end; it != end; ++it ) {
+			if( ci::fs::is_regular_file( it->path() ) ) {
+				size += ci::fs::file_size( it->path() );
+			}
+		}
+	}
+	return size;
+}
+
+//! Dedicated thread on which the interpreter parses and jit-compiles new generations of the runtime classes
+class CompileWorker {
+public:
+	static CompileWorker& get() { static CompileWorker worker; return worker; }
+
+	//! Queues a job to be executed on the compile thread
+	void enqueue( const std::function<void()> &job );
+	//! Queues a job that will only run once no other job with the same \a key has been queued for \a window seconds. A newer job cancels the one already waiting.
+	void enqueue( const std::string &key, double window, const std::function<void()> &job );
+	//! Returns whether the calling thread is the compile thread
+	bool isCompileThread() const { return std::this_thread::get_id() == mThread.get_id(); }
+	//! Returns the number of jobs that have been cancelled by a newer job with the same key
+	size_t getNumCoalesced() const { return mNumCoalesced; }
+	//! Returns whether the worker is shutting down. Long jobs should check it between steps and return early.
+	bool isStopping() const { return mQuit; }
+
+	~CompileWorker();
+
+protected:
+	CompileWorker();
+	void run();
+
+	struct Job {
+		std::string								mKey;
+		std::chrono::steady_clock::time_point	mDeadline;
+		std::function<void()>					mFn;
+	};
+
+	std::atomic<bool>					mQuit;
+	std::atomic<size_t>					mNumCoalesced;
+	std::mutex							mMutex;
+	std::condition_variable				mCondition;
+	std::deque<Job>						mJobs;
+	std::thread							mThread;
+};
+
+inline CompileWorker::CompileWorker()
+: mQuit( false ), mNumCoalesced( 0 )
+{
+	mThread = std::thread( &CompileWorker::run, this );
+}
+
+inline CompileWorker::~CompileWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mQuit = true;
+		mJobs.clear();
+	}
+	// the job in flight returns at its next isStopping check, only the step it is running delays the exit
+	mCondition.notify_one();
+	if( mThread.joinable() ) {
+		mThread.join();
+	}
+}
+
+inline void CompileWorker::enqueue( const std::function<void()> &job )
+{
+	enqueue( std::string(), 0.0, job );
+}
+
+inline void CompileWorker::enqueue( const std::string &key, double window, const std::function<void()> &job )
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::duration<double>( window ) );
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		if( mQuit ) {
+			return;
+		}
+		bool coalesced = false;
+		if( ! key.empty() ) {
+			for( auto &pending : mJobs ) {
+				if( pending.mKey == key ) {
+					pending.mDeadline = deadline;
+					pending.mFn = job;
+					coalesced = true;
+					mNumCoalesced++;
+					break;
+				}
+			}
+		}
+		if( ! coalesced ) {
+			mJobs.push_back( { key, deadline, job } );
+		}
+	}
+	mCondition.notify_one();
+}
+
+inline void CompileWorker::run()
+{
+	while( true ) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock( mMutex );
+			while( ! job ) {
+				if( mQuit ) {
+					return;
+				}
+				if( mJobs.empty() ) {
+					mCondition.wait( lock );
+					continue;
+				}
+				// run the first job whose window has elapsed or wait for the closest one
+				auto next = mJobs.begin();
+				for( auto it = mJobs.begin(); it != mJobs.end(); ++it ) {
+					if( it->mDeadline < next->mDeadline ) {
+						next = it;
+					}
+				}
+				if( next->mDeadline <= std::chrono::steady_clock::now() ) {
+					job = next->mFn;
+					mJobs.erase( next );
+				}
+				else {
+					mCondition.wait_until( lock, next->mDeadline );
+				}
+			}
+		}
+		// a failing job must not take the compile thread, and the app, down with it
+		try {
+			job();
+		}
+		catch( const std::exception &exc ) {
+			CI_LOG_E( "Compile job failed: " << exc.what() );
+		}
+		catch( ... ) {
+			CI_LOG_E( "Compile job failed with an unknown exception" );
+		}
+	}
+}
+
+} // namespace runtime
@@ -0,0 +1,414 @@
+/*
+ Cinder-Runtime
+ Includes
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cinder/Filesystem.h"
+#include "runtime_compiler.h"
+#include "runtime_source.h"
+#include "runtime_watcher.h"
+
+namespace runtime {
+
+//! Graph of the project headers included by the runtime classes. Only quoted includes that can be found next to the
+//! including file or in the include paths of the class are part of the graph. Each class is reloaded when one of
+//! its sources or one of the headers it depends on, directly or not, changes.
+class IncludeGraph {
+public:
+	static IncludeGraph& get() { static IncludeGraph graph; return graph; }
+
+	//! Sets the \a sources of \a owner and the \a includes lines found in them, and calls \a callback on the watch thread whenever one of the files changes, with true if one of them is a header \a owner depends on.
+	//! Only the files reported by the watcher are read again afterwards, the graph and the watched files follow the includes they add or remove
+	void update( const std::string &owner, const std::vector<ci::fs::path> &sources, const std::vector<std::string> &includes, const std::vector<ci::fs::path> &includePaths, const std::function<void(bool)> &callback );
+	//! Returns the project headers \a owner depends on, the ones included by the others first
+	std::vector<ci::fs::path> getDependencies( const std::string &owner ) const;
+	//! Returns the owners depending on \a header
+	std::vector<std::string> getDependents( const ci::fs::path &header ) const;
+	//! Returns the project headers directly included by \a header
+	std::vector<ci::fs::path> getIncludes( const ci::fs::path &header ) const;
+	//! Returns the owners registered in the graph
+	std::vector<std::string> getOwners() const;
+	//! Returns whether \a header changed since it was added to the graph. Doesn't read the file, its hash is updated when the watcher reports a change
+	bool hasChanged( const ci::fs::path &header ) const;
+
+	//! Returns the project header included by the include directive \a line, or an empty path if it's a system header or can't be found
+	static ci::fs::path resolve( const std::string &line, const ci::fs::path &directory, const std::vector<ci::fs::path> &includePaths );
+	//! Returns the content of \a header without its includes and include guard, so it can be parsed again by an interpreter that already included it
+	static std::string getInlinableCode( const ci::fs::path &header );
+	//! Returns whether \a code declares a class, struct, union or enum. Parsed again in another namespace it would be a distinct type
+	static bool declaresTypes( const std::string &code );
+
+protected:
+	IncludeGraph() {}
+	void addNode( const std::string &path, const std::vector<ci::fs::path> &includePaths );
+	//! Reads the files of \a owner that changed again, and its includes if one of them is a source
+	void refresh( const std::string &owner, const std::vector<ci::fs::path> &changed );
+	//! Resolves the includes of the sources of \a owner
+	void resolveIncludes( const std::string &owner );
+	//! Watches the sources of \a owner and the headers it depends on, again only if the set of files changed
+	void watch( const std::string &owner );
+	void addDependencies( const std::string &path, std::set<std::string> &visited, std::vector<std::string> &dependencies ) const;
+
+	struct Node {
+		std::vector<std::string>	mIncludes;
+		uint64_t					mBaseHash, mHash;
+	};
+	struct Owner {
+		Owner() : mWatch( 0 ), mWatching( false ) {}
+		std::vector<std::string>	mSources;
+		std::vector<std::string>	mIncludes;
+		std::vector<ci::fs::path>	mIncludePaths;
+		std::vector<std::string>	mWatchedFiles;
+		std::function<void(bool)>	mCallback;
+		size_t						mWatch;
+		bool						mWatching;
+	};
+
+	mutable std::recursive_mutex		mMutex;
+	std::map<std::string,Node>			mNodes;
+	std::map<std::string,Owner>			mOwners;
+};
+
+inline ci::fs::path IncludeGraph::resolve( const std::string &line, const ci::fs::path &directory, const std::vector<ci::fs::path> &includePaths )
+{
+	// the lines come from SourceAssembler, which already recognized them as include directives
+	size_t begin = line.find_first_of( "\"<" );
+	size_t end = begin == std::string::npos || line[begin] != '"' ? std::string::npos : line.find( '"', begin + 1 );
+	if( end == std::string::npos ) {
+		return ci::fs::path();
+	}
+	std::string name = line.substr( begin + 1, end - begin - 1 );
+	std::vector<ci::fs::path> directories = { directory };
+	directories.insert( directories.end(), includePaths.begin(), includePaths.end() );
+	for( const auto &dir : directories ) {
+		if( ci::fs::exists( dir / name ) ) {
+			return ci::fs::canonical( dir / name );
+		}
+	}
+	return ci::fs::path();
+}
+
+inline void IncludeGraph::addNode( const std::string &path, const std::vector<ci::fs::path> &includePaths )
+{
+	// also called again when the watcher reports a change of the header, its content is compared to the first version
+	bool added = ! mNodes.count( path );
+	Node &node = mNodes[path];
+	node.mHash = hash( readFile( path ) );
+	if( added ) {
+		node.mBaseHash = node.mHash;
+	}
+	node.mIncludes.clear();
+	for( const auto &include : SourceAssembler::get().getChunk( path )->mIncludes ) {
+		auto header = resolve( include, ci::fs::path( path ).parent_path(), includePaths );
+		if( ! header.empty() ) {
+			node.mIncludes.push_back( header.string() );
+		}
+	}
+	for( const auto &include : std::vector<std::string>( node.mIncludes ) ) {
+		if( ! mNodes.count( include ) ) {
+			addNode( include, includePaths );
+		}
+	}
+}
+
+inline void IncludeGraph::update( const std::string &owner, const std::vector<ci::fs::path> &sources, const std::vector<std::string> &includes, const std::vector<ci::fs::path> &includePaths, const std::function<void(bool)> &callback )
+{
+	std::lock_guard<std::recursive_mutex> lock( mMutex );
+	Owner &entry = mOwners[owner];
+	entry.mSources.clear();
+	entry.mIncludes.clear();
+	entry.mIncludePaths = includePaths;
+	entry.mCallback = callback;
+	ci::fs::path directory = sources.empty() ? ci::fs::path() : sources.front().parent_path();
+	for( const auto &source : sources ) {
+		entry.mSources.push_back( source.string() );
+	}
+	for( const auto &line : includes ) {
+		auto header = resolve( line, directory, includePaths );
+		if( ! header.empty() ) {
+			entry.mIncludes.push_back( header.string() );
+			addNode( header.string(), includePaths );
+		}
+	}
+	watch( owner );
+}
+
+inline void IncludeGraph::refresh( const std::string &owner, const std::vector<ci::fs::path> &changed )
+{
+	Owner &entry = mOwners[owner];
+	bool sourceChanged = false;
+	for( const auto &path : changed ) {
+		if( std::find( entry.mSources.begin(), entry.mSources.end(), path.string() ) != entry.mSources.end() ) {
+			sourceChanged = true;
+		}
+		else if( mNodes.count( path.string() ) ) {
+			addNode( path.string(), entry.mIncludePaths );
+		}
+	}
+	if( sourceChanged ) {
+		resolveIncludes( owner );
+	}
+	watch( owner );
+}
+
+inline void IncludeGraph::resolveIncludes( const std::string &owner )
+{
+	// the sources include each other, a .cpp its own header, which isn't part of the graph
+	Owner &entry = mOwners[owner];
+	entry.mIncludes.clear();
+	for( const auto &source : entry.mSources ) {
+		for( const auto &include : SourceAssembler::get().getChunk( source )->mIncludes ) {
+			auto header = resolve( include, ci::fs::path( source ).parent_path(), entry.mIncludePaths );
+			if( header.empty() || std::find( entry.mSources.begin(), entry.mSources.end(), header.string() ) != entry.mSources.end() ) {
+				continue;
+			}
+			if( std::find( entry.mIncludes.begin(), entry.mIncludes.end(), header.string() ) == entry.mIncludes.end() ) {
+				entry.mIncludes.push_back( header.string() );
+			}
+			if( ! mNodes.count( header.string() ) ) {
+				addNode( header.string(), entry.mIncludePaths );
+			}
+		}
+	}
+}
+
+inline void IncludeGraph::watch( const std::string &owner )
+{
+	Owner &entry = mOwners[owner];
+	std::vector<std::string> watchedFiles = entry.mSources;
+	for( const auto &dependency : getDependencies( owner ) ) {
+		watchedFiles.push_back( dependency.string() );
+	}
+	if( entry.mWatching && watchedFiles == entry.mWatchedFiles ) {
+		return;
+	}
+	if( entry.mWatching ) {
+		WatchService::get().unwatch( entry.mWatch );
+	}
+	entry.mWatchedFiles = watchedFiles;
+	entry.mWatch = WatchService::get().watch( std::vector<ci::fs::path>( watchedFiles.begin(), watchedFiles.end() ), [this,owner]( const std::vector<ci::fs::path> &changed ) {
+		std::function<void(bool)> callback;
+		bool headerChanged = false;
+		{
+			std::lock_guard<std::recursive_mutex> lock( mMutex );
+			callback = mOwners[owner].mCallback;
+			auto dependencies = getDependencies( owner );
+			for( const auto &path : changed ) {
+				headerChanged = headerChanged || std::find( dependencies.begin(), dependencies.end(), path ) != dependencies.end();
+			}
+			refresh( owner, changed );
+		}
+		if( callback ) {
+			callback( headerChanged );
+		}
+	} );
+	entry.mWatching = true;
+}
+
+inline void IncludeGraph::addDependencies( const std::string &path, std::set<std::string> &visited, std::vector<std::string> &dependencies ) const
+{
+	if( ! visited.insert( path ).second ) {
+		return;
+	}
+	auto node = mNodes.find( path );
+	if( node != mNodes.end() ) {
+		for( const auto &include : node->second.mIncludes ) {
+			addDependencies( include, visited, dependencies );
+		}
+	}
+	dependencies.push_back( path );
+}
+
+inline std::vector<ci::fs::path> IncludeGraph::getDependencies( const std::string &owner ) const
+{
+	std::lock_guard<std::recursive_mutex> lock( mMutex );
+	std::set<std::string> visited;
+	std::vector<std::string> dependencies;
+	auto entry = mOwners.find( owner );
+	if( entry != mOwners.end() ) {
+		for( const auto &include : entry->second.mIncludes ) {
+			addDependencies( include, visited, dependencies );
+		}
+	}
+	return std::vector<ci::fs::path>( dependencies.begin(), dependencies.end() );
+}
+
+inline std::vector<std::string> IncludeGraph::getDependents( const ci::fs::path &header ) const
+{
+	std::lock_guard<std::recursive_mutex> lock( mMutex );
+	std::vector<std::string> dependents;
+	for( const auto &owner : mOwners ) {
+		for( const auto &dependency : getDependencies( owner.first ) ) {
+			if( dependency == header ) {
+				dependents.push_back( owner.first );
+				break;
+			}
+		}
+	}
+	return dependents;
+}
+
+inline std::vector<ci::fs::path> IncludeGraph::getIncludes( const ci::fs::path &header ) const
+{
+	std::lock_guard<std::recursive_mutex> lock( mMutex );
+	auto node = mNodes.find( header.string() );
+	if( node == mNodes.end() ) {
+		return {};
+	}
+	return std::vector<ci::fs::path>( node->second.mIncludes.begin(), node->second.mIncludes.end() );
+}
+
+inline std::vector<std::string> IncludeGraph::getOwners() const
+{
+	std::lock_guard<std::recursive_mutex> lock( mMutex );
+	std::vector<std::string> owners;
+	for( const auto &owner : mOwners ) {
+		owners.push_back( owner.first );
+	}
+	return owners;
+}
+
+inline bool IncludeGraph::hasChanged( const ci::fs::path &header ) const
+{
+	std::lock_guard<std::recursive_mutex> lock( mMutex );
+	auto node = mNodes.find( header.string() );
+	return node != mNodes.end() && node->second.mHash != node->second.mBaseHash;
+}
+
+inline std::string IncludeGraph::getInlinableCode( const ci::fs::path &header )
+{
+	auto directive = []( const std::string &line, const std::string &name ) {
+		std::istringstream tokens( line );
+		std::string token;
+		tokens >> token;
+		if( token == "#" ) {
+			tokens >> token;
+			token = "#" + token;
+		}
+		return token == name;
+	};
+	
+	// the includes are already set apart by SourceAssembler, each line of its code ends with " \n"
+	const std::string &chunkCode = SourceAssembler::get().getChunk( header )->mCode;
+	std::vector<std::string> lines;
+	for( size_t begin = 0; begin < chunkCode.size(); ) {
+		size_t end = chunkCode.find( '\n', begin );
+		end = end == std::string::npos ? chunkCode.size() : end;
+		std::string line = chunkCode.substr( begin, end - begin );
+		begin = end + 1;
+		if( ! directive( line, "#pragma" ) || line.find( "once" ) == std::string::npos ) {
+			lines.push_back( line.size() >= 1 && line.back() == ' ' ? line.substr( 0, line.size() - 1 ) : line );
+		}
+	}
+
+	// an include guard would skip the whole header as it's already defined
+	size_t first = 0;
+	while( first < lines.size() && ( lines[first].find_first_not_of( " \t\r" ) == std::string::npos || lines[first][lines[first].find_first_not_of( " \t\r" )] != '#' ) ) {
+		first++;
+	}
+	if( first + 1 < lines.size() && directive( lines[first], "#ifndef" ) && directive( lines[first + 1], "#define" ) ) {
+		for( size_t last = lines.size(); last > first + 2; --last ) {
+			if( directive( lines[last - 1], "#endif" ) ) {
+				lines.erase( lines.begin() + ( last - 1 ) );
+				lines.erase( lines.begin() + first, lines.begin() + first + 2 );
+				break;
+			}
+		}
+	}
+
+	std::string code;
+	for( const auto &codeLine : lines ) {
+		code += codeLine + " \n";
+	}
+	return code;
+}
+
+inline bool IncludeGraph::declaresTypes( const std::string &code )
+{
+	// looks for the keywords followed by a name, or not, and the start of a definition, a base clause or the end of a forward declaration
+	auto isIdentifier = []( char c ) { return std::isalnum( static_cast<unsigned char>( c ) ) || c == '_'; };
+	std::vector<std::string> tokens;
+	for( size_t i = 0; i < code.size(); ) {
+		char c = code[i];
+		if( code.compare( i, 2, "//" ) == 0 ) {
+			i = code.find( '\n', i );
+		}
+		else if( code.compare( i, 2, "/*" ) == 0 ) {
+			i = code.find( "*/", i + 2 );
+			i = i == std::string::npos ? i : i + 2;
+		}
+		else if( c == '"' || c == '\'' ) {
+			for( ++i; i < code.size() && code[i] != c; ++i ) {
+				i += code[i] == '\\' ? 1 : 0;
+			}
+			i = i < code.size() ? i + 1 : i;
+		}
+		else if( isIdentifier( c ) ) {
+			size_t begin = i;
+			while( i < code.size() && isIdentifier( code[i] ) ) {
+				++i;
+			}
+			tokens.push_back( code.substr( begin, i - begin ) );
+		}
+		else {
+			if( ! std::isspace( static_cast<unsigned char>( c ) ) ) {
+				tokens.push_back( std::string( 1, c ) );
+			}
+			++i;
+		}
+		if( i == std::string::npos ) {
+			break;
+		}
+	}
+	for( size_t i = 0; i < tokens.size(); ++i ) {
+		if( tokens[i] != "class" && tokens[i] != "struct" && tokens[i] != "union" && tokens[i] != "enum" ) {
+			continue;
+		}
+		size_t next = i + 1;
+		if( tokens[i] == "enum" && next < tokens.size() && ( tokens[next] == "class" || tokens[next] == "struct" ) ) {
+			++next;
+		}
+		if( next < tokens.size() && isIdentifier( tokens[next].front() ) ) {
+			++next;
+		}
+		if( next < tokens.size() && tokens[next] == "final" ) {
+			++next;
+		}
+		if( next < tokens.size() && ( tokens[next] == "{" || tokens[next] == ":" || tokens[next] == ";" ) ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace runtime
@@ -0,0 +1,656 @@
+/*
+ Cinder-Runtime
+ Interpreter
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined( __APPLE__ )
+#include <mach/mach.h>
+#elif defined( __linux__ )
+#include <fstream>
+#include <unistd.h>
+#endif
+
+#include "cinder/Filesystem.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/Mangle.h"
+#include "clang/AST/RecordLayout.h"
+#include "clang/AST/VTableBuilder.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "cling/Interpreter/Interpreter.h"
+#include "cling/Interpreter/LookupHelper.h"
+#include "cling/Interpreter/Transaction.h"
+#include "runtime_compiler.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace runtime {
+
+//! Returns the resident memory of the process in bytes or 0 if it can't be measured on this platform
+inline size_t getResidentMemory()
+{
+#if defined( __APPLE__ )
+	mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if( task_info( mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>( &info ), &count ) == KERN_SUCCESS ) {
+		return static_cast<size_t>( info.resident_size );
+	}
+	return 0;
+#elif defined( __linux__ )
+	size_t size = 0, resident = 0;
+	std::ifstream statm( "/proc/self/statm" );
+	if( statm >> size >> resident ) {
+		return resident * static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+	}
+	return 0;
+#else
+	return 0;
+#endif
+}
+
+//! Memory layout of a class as seen by the interpreter, including the members and vtable pointers of its bases
+struct ClassLayout {
+	ClassLayout() : mSize( 0 ), mAlignment( 0 ) {}
+	
+	struct Field {
+		std::string	mName;
+		std::string	mType;
+		size_t		mOffset;
+		size_t		mSize;
+		bool		mBitField;
+		bool		mTriviallyCopyable;
+		bool		mPointer;
+	};
+	
+	//! Returns whether the layout could be computed. Classes with virtual bases aren't supported
+	bool isValid() const { return mSize != 0; }
+	//! Returns whether objects of both layouts can be used interchangeably
+	bool operator==( const ClassLayout &other ) const;
+	bool operator!=( const ClassLayout &other ) const { return ! ( *this == other ); }
+	//! Returns a hash of the size, alignment, fields and vtable pointers. Layouts with the same fingerprint can be used interchangeably
+	uint64_t getFingerprint() const;
+	
+	//! Returns the pairs of indices of the fields of \a from and \a to with the same name and type. Only the most derived field is considered when several classes of the hierarchy use the same name
+	static std::vector<std::pair<size_t,size_t>> matchFields( const ClassLayout &from, const ClassLayout &to );
+	//! Returns whether a field can be copied with memcpy. Pointers are excluded as the object they point to might be owned by the previous instance
+	static bool isMemcpyable( const Field &field ) { return field.mTriviallyCopyable && ! field.mBitField && ! field.mPointer; }
+	//! Copies the matching fields that can be copied with memcpy from \a source to \a destination. Returns the number of fields copied
+	static size_t copyTrivialFields( const ClassLayout &from, const void *source, const ClassLayout &to, void *destination );
+	//! Returns whether a field that can't be copied with memcpy can be assigned by the migration code
+	static bool isMovable( const Field &field ) { return ! isMemcpyable( field ) && ! field.mBitField && ! field.mPointer; }
+	//! Returns the code of an extern "C" function \a name( void *from, void *to, bool move ) assigning the matching fields of \a from that can't be copied with memcpy to \a to, or an empty string if there is none. The fields are copied, or moved if \a move is true
+	static std::string getMigrationCode( const std::string &name, const ClassLayout &from, const ClassLayout &to );
+	//! Returns the code of an extern "C" function bool \a name( void *from, void *to, bool move ) constructing every field of \a to in raw memory from the matching field of \a from, vtable pointers excepted. A field of \a from matching several fields of \a to is only moved into the last one. Returns an empty string if a field has no match or is a pointer, a reference or a bit-field. The function returns false without touching \a to if a field can't be copy-constructed
+	static std::string getConstructionCode( const std::string &name, const ClassLayout &from, const ClassLayout &to );
+	//! Returns the declarations the migration code depends on, fields that can't be assigned are skipped
+	static std::string getMigrationHelpers();
+	
+	size_t					mSize;
+	size_t					mAlignment;
+	//! Every member in declaration order, the ones of the bases first. The names are prefixed by the unqualified name of the class that declares them
+	std::vector<Field>		mFields;
+	//! Offsets of the vtable pointers in the object
+	std::vector<size_t>		mVTablePointers;
+	//! Mangled name of the vtable of the class, empty if the class isn't polymorphic or the ABI isn't Itanium
+	std::string				mVTableName;
+	//! Index in the vtable of the address stored by each vtable pointer, in pointer-sized entries
+	std::vector<size_t>		mVTableAddressPoints;
+};
+
+//! Error, warning or note reported by the interpreter while compiling a new version of the code
+struct Diagnostic {
+	enum class Level { NOTE, WARNING, ERROR };
+	Level		mLevel;
+	std::string	mMessage;
+	// position in the code given to the interpreter, which is preceded by the includes and wrapped in a namespace
+	std::string	mFile;
+	unsigned	mLine, mColumn;
+};
+
+//! Records the diagnostics of \a interpreter for the lifetime of the object, still forwarding them to the previous consumer
+class ScopedDiagnostics : public clang::DiagnosticConsumer {
+public:
+	ScopedDiagnostics( cling::Interpreter *interpreter );
+	~ScopedDiagnostics();
+
+	//! Returns the diagnostics reported so far
+	const std::vector<runtime::Diagnostic>& getDiagnostics() const { return mDiagnostics; }
+
+	void BeginSourceFile( const clang::LangOptions &langOpts, const clang::Preprocessor *pp ) override;
+	void EndSourceFile() override;
+	void HandleDiagnostic( clang::DiagnosticsEngine::Level level, const clang::Diagnostic &info ) override;
+
+protected:
+	clang::DiagnosticsEngine&					mEngine;
+	clang::DiagnosticConsumer*					mClient;
+	std::unique_ptr<clang::DiagnosticConsumer>	mOwnedClient;
+	std::vector<runtime::Diagnostic>			mDiagnostics;
+};
+
+class SharedInterpreter;
+typedef std::shared_ptr<SharedInterpreter> SharedInterpreterRef;
+
+//! cling::Interpreter shared by every runtime class compiled with the same command line
+class SharedInterpreter {
+public:
+	SharedInterpreter( const std::vector<std::string> &args );
+
+	//! Returns the cling interpreter
+	const std::shared_ptr<cling::Interpreter>& getInterpreter() const { return mInterpreter; }
+	//! Returns the mutex that needs to be locked before using the interpreter
+	std::recursive_mutex& getMutex() { return mMutex; }
+	//! Returns the command line the interpreter was created with
+	const std::string& getKey() const { return mKey; }
+
+	//! Adds an include path to the interpreter unless it was already added by another class
+	void addIncludePath( const ci::fs::path &path );
+	//! Loads a dynamic library unless it was already loaded by another class
+	void loadFile( const ci::fs::path &path );
+	//! Declares \a declaration unless the exact same declaration was already processed
+	void declare( const std::string &declaration );
+	//! Loads Cinder's headers and dynamic library once
+	void loadCinder();
+
+	//! Returns the transactions the interpreter processed after \a last, the value getLastTransaction returned before they were declared. The interpreter needs to be locked
+	std::vector<cling::Transaction*> getTransactionsSince( const cling::Transaction *last ) const;
+	//! Marks \a transactions as no longer needed. The interpreter can only unload its last transaction, so they are unloaded once every transaction processed after them has been released too. Returns the number of transactions unloaded. The interpreter needs to be locked
+	size_t release( const std::vector<cling::Transaction*> &transactions );
+	//! Returns the number of released transactions still loaded because code processed after them is in use. As the current generation of
+	//! each class is always needed, this grows with every generation applied to the instances until the app quits
+	size_t getNumReleasedTransactions() const { return mReleased.size(); }
+	//! Returns the number of transactions actually unloaded from the interpreter
+	size_t getNumUnloadedTransactions() const { return mNumUnloaded; }
+
+	//! Returns the number of runtime classes using this interpreter
+	size_t getNumClasses() const { return mNumClasses; }
+	//! Returns an approximation of the resident memory used by this interpreter, in bytes. It adds up the growth of the resident memory of the whole process while the interpreter was compiling, which includes whatever the other threads allocated meanwhile and misses memory the allocator reused. getHeapSize is exact but only covers the AST
+	size_t getResidentMemory() const { return mResidentMemory; }
+	//! Returns the memory allocated by the AST of the interpreter, in bytes
+	size_t getHeapSize() const;
+
+	//! Attributes the growth of the resident memory of the process during the scope of the object to the interpreter. The measure is approximate, see getResidentMemory
+	struct ScopedMemoryMeasure {
+		ScopedMemoryMeasure( SharedInterpreter *interpreter ) : mInterpreter( interpreter ), mStart( runtime::getResidentMemory() ) {}
+		~ScopedMemoryMeasure()
+		{
+			size_t end = runtime::getResidentMemory();
+			if( end > mStart ) mInterpreter->mResidentMemory += end - mStart;
+			else mInterpreter->mResidentMemory -= std::min( mInterpreter->mResidentMemory, mStart - end );
+		}
+		SharedInterpreter*	mInterpreter;
+		size_t				mStart;
+	};
+
+protected:
+	friend class InterpreterPool;
+
+	std::shared_ptr<cling::Interpreter>	mInterpreter;
+	std::recursive_mutex				mMutex;
+	std::string							mKey;
+	std::set<std::string>				mIncludePaths, mDynamicLibraries, mDeclarations;
+	std::set<const cling::Transaction*>	mReleased;
+	bool								mCinderLoaded;
+	size_t								mNumClasses;
+	size_t								mNumUnloaded;
+	size_t								mResidentMemory;
+};
+
+//! Keeps one interpreter per distinct command line so runtime classes don't pay for a Clang instance each
+class InterpreterPool {
+public:
+	static InterpreterPool& get() { static InterpreterPool pool; return pool; }
+
+	//! Returns the interpreter created with \a args, creating it if no other class uses the same command line yet. A non-empty \a owner gives the caller its own interpreter
+	SharedInterpreterRef acquire( const std::vector<std::string> &args, const std::string &owner = std::string() );
+	//! Returns all the interpreters of the pool
+	std::vector<SharedInterpreterRef> getInterpreters() const;
+
+protected:
+	mutable std::mutex							mMutex;
+	std::map<std::string,SharedInterpreterRef>	mInterpreters;
+};
+
+inline ScopedDiagnostics::ScopedDiagnostics( cling::Interpreter *interpreter )
+: mEngine( interpreter->getCI()->getDiagnostics() ), mClient( mEngine.getClient() )
+{
+	if( mEngine.ownsClient() ) {
+		mOwnedClient = mEngine.takeClient();
+	}
+	mEngine.setClient( this, false );
+}
+
+inline ScopedDiagnostics::~ScopedDiagnostics()
+{
+	bool owned = mOwnedClient != nullptr;
+	mOwnedClient.release();
+	mEngine.setClient( mClient, owned );
+}
+
+inline void ScopedDiagnostics::BeginSourceFile( const clang::LangOptions &langOpts, const clang::Preprocessor *pp )
+{
+	if( mClient ) {
+		mClient->BeginSourceFile( langOpts, pp );
+	}
+}
+
+inline void ScopedDiagnostics::EndSourceFile()
+{
+	if( mClient ) {
+		mClient->EndSourceFile();
+	}
+}
+
+inline void ScopedDiagnostics::HandleDiagnostic( clang::DiagnosticsEngine::Level level, const clang::Diagnostic &info )
+{
+	// keeps the error and warning counts of the consumer up to date
+	clang::DiagnosticConsumer::HandleDiagnostic( level, info );
+	if( mClient ) {
+		mClient->HandleDiagnostic( level, info );
+	}
+	if( level == clang::DiagnosticsEngine::Ignored ) {
+		return;
+	}
+
+	runtime::Diagnostic diagnostic;
+	diagnostic.mLevel = level >= clang::DiagnosticsEngine::Error ? runtime::Diagnostic::Level::ERROR : level == clang::DiagnosticsEngine::Warning ? runtime::Diagnostic::Level::WARNING : runtime::Diagnostic::Level::NOTE;
+	llvm::SmallString<256> message;
+	info.FormatDiagnostic( message );
+	diagnostic.mMessage = message.str();
+	diagnostic.mLine = diagnostic.mColumn = 0;
+	if( info.getLocation().isValid() && info.hasSourceManager() ) {
+		auto location = info.getSourceManager().getPresumedLoc( info.getLocation() );
+		if( location.isValid() ) {
+			diagnostic.mFile = location.getFilename();
+			diagnostic.mLine = location.getLine();
+			diagnostic.mColumn = location.getColumn();
+		}
+	}
+	mDiagnostics.push_back( diagnostic );
+}
+
+inline SharedInterpreter::SharedInterpreter( const std::vector<std::string> &args )
+: mCinderLoaded( false ), mNumClasses( 0 ), mNumUnloaded( 0 ), mResidentMemory( 0 )
+{
+	ScopedMemoryMeasure measure( this );
+
+	std::vector<const char*> interpreterArgs;
+	for( const auto &arg : args ) {
+		interpreterArgs.push_back( arg.c_str() );
+		mKey += arg + " ";
+	}
+	auto blockPath = ci::fs::path( __FILE__ ).parent_path().parent_path();
+	mInterpreter = std::make_shared<cling::Interpreter>( interpreterArgs.size(), interpreterArgs.data(), ( blockPath.string() + "/lib/" ).c_str() );
+}
+
+inline bool ClassLayout::operator==( const ClassLayout &other ) const
+{
+	if( mSize != other.mSize || mAlignment != other.mAlignment || mVTablePointers != other.mVTablePointers || mFields.size() != other.mFields.size() ) {
+		return false;
+	}
+	for( size_t i = 0; i < mFields.size(); ++i ) {
+		const auto &a = mFields[i];
+		const auto &b = other.mFields[i];
+		if( a.mName != b.mName || a.mType != b.mType || a.mOffset != b.mOffset || a.mBitField != b.mBitField ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline uint64_t ClassLayout::getFingerprint() const
+{
+	std::stringstream description;
+	description << mSize << " " << mAlignment;
+	for( size_t offset : mVTablePointers ) {
+		description << " vptr@" << offset;
+	}
+	for( const auto &field : mFields ) {
+		description << " " << field.mType << " " << field.mName << ( field.mBitField ? ":" : "@" ) << field.mOffset;
+	}
+	return hash( description.str() );
+}
+
+inline std::vector<std::pair<size_t,size_t>> ClassLayout::matchFields( const ClassLayout &from, const ClassLayout &to )
+{
+	// the most derived field with a given name is the last one
+	auto findLast = []( const ClassLayout &layout, const std::string &name, size_t end ) {
+		for( size_t i = end; i > 0; --i ) {
+			if( layout.mFields[i - 1].mName == name ) {
+				return i - 1;
+			}
+		}
+		return layout.mFields.size();
+	};
+	
+	std::vector<std::pair<size_t,size_t>> matches;
+	for( size_t i = 0; i < to.mFields.size(); ++i ) {
+		const auto &field = to.mFields[i];
+		if( findLast( to, field.mName, to.mFields.size() ) != i ) {
+			continue;
+		}
+		size_t j = findLast( from, field.mName, from.mFields.size() );
+		if( j < from.mFields.size() && from.mFields[j].mType == field.mType && from.mFields[j].mBitField == field.mBitField ) {
+			matches.push_back( std::make_pair( j, i ) );
+		}
+	}
+	return matches;
+}
+
+inline size_t ClassLayout::copyTrivialFields( const ClassLayout &from, const void *source, const ClassLayout &to, void *destination )
+{
+	size_t numCopied = 0;
+	for( const auto &match : matchFields( from, to ) ) {
+		const auto &sourceField = from.mFields[match.first];
+		const auto &destinationField = to.mFields[match.second];
+		if( isMemcpyable( destinationField ) ) {
+			std::memcpy( static_cast<char*>( destination ) + destinationField.mOffset, static_cast<const char*>( source ) + sourceField.mOffset, destinationField.mSize );
+			numCopied++;
+		}
+	}
+	return numCopied;
+}
+
+inline std::string ClassLayout::getMigrationCode( const std::string &name, const ClassLayout &from, const ClassLayout &to )
+{
+	// the fields are accessed through their offset and canonical type as they might be private
+	std::string code;
+	for( const auto &match : matchFields( from, to ) ) {
+		const auto &sourceField = from.mFields[match.first];
+		const auto &destinationField = to.mFields[match.second];
+		if( isMovable( destinationField ) ) {
+			code += "\truntime_migration::migrate<" + destinationField.mType + ">( static_cast<char*>( from ) + " + std::to_string( sourceField.mOffset ) + ", static_cast<char*>( to ) + " + std::to_string( destinationField.mOffset ) + ", move );\n";
+		}
+	}
+	if( code.empty() ) {
+		return code;
+	}
+	return "extern \"C\" void " + name + "( void *from, void *to, bool move )\n{\n" + code + "}\n";
+}
+
+inline std::string ClassLayout::getConstructionCode( const std::string &name, const ClassLayout &from, const ClassLayout &to )
+{
+	if( ! from.isValid() || ! to.isValid() ) {
+		return "";
+	}
+	
+	// every field needs a value, the copies of the fields in the bases of the generation included as the natively
+	// compiled methods use them. The nth field with a given name is matched with the nth one of the same name, or
+	// with the last one when the previous layout has fewer, as the native class has one copy where a generation has two
+	std::vector<const Field*> sources;
+	std::map<const Field*,size_t> numUses;
+	std::map<std::string,size_t> occurrences;
+	for( const auto &field : to.mFields ) {
+		size_t occurrence = occurrences[field.mName]++;
+		const Field *source = nullptr;
+		size_t sourceOccurrence = 0;
+		for( const auto &candidate : from.mFields ) {
+			if( candidate.mName == field.mName ) {
+				source = &candidate;
+				if( sourceOccurrence++ == occurrence ) {
+					break;
+				}
+			}
+		}
+		if( ! source || source->mType != field.mType || field.mBitField || field.mPointer || source->mBitField ) {
+			return "";
+		}
+		sources.push_back( source );
+		numUses[source]++;
+	}
+	
+	// a field used by several copies is only moved into the last one, the others get a copy
+	std::string code, types;
+	for( size_t i = 0; i < to.mFields.size(); ++i ) {
+		const auto &field = to.mFields[i];
+		const Field *source = sources[i];
+		std::string fromAddress = "static_cast<char*>( from ) + " + std::to_string( source->mOffset );
+		std::string toAddress = "static_cast<char*>( to ) + " + std::to_string( field.mOffset );
+		if( field.mTriviallyCopyable ) {
+			code += "\tstd::memcpy( " + toAddress + ", " + fromAddress + ", " + std::to_string( field.mSize ) + " );\n";
+		}
+		else {
+			code += "\truntime_migration::construct<" + field.mType + ">( " + fromAddress + ", " + toAddress + ( --numUses[source] ? ", false );\n" : ", move );\n" );
+			types += ( types.empty() ? "" : ", " ) + field.mType;
+		}
+	}
+	return "extern \"C\" bool " + name + "( void *from, void *to, bool move )\n{\n"
+		"\tif( ! runtime_migration::Constructible<" + types + ">::value ) {\n"
+		"\t\treturn false;\n"
+		"\t}\n" + code +
+		"\treturn true;\n"
+		"}\n";
+}
+
+inline std::string ClassLayout::getMigrationHelpers()
+{
+	// the previous instance might still be shared or read by other threads, its fields are only moved when it can't be
+	return	"#include <cstring>\n"
+			"#include <new>\n"
+			"#include <type_traits>\n"
+			"#include <utility>\n"
+			"namespace runtime_migration {\n"
+			"	template<class U> typename std::enable_if<std::is_copy_assignable<U>::value>::type migrate( void *from, void *to, bool move ) { if( move ) *static_cast<U*>( to ) = std::move( *static_cast<U*>( from ) ); else *static_cast<U*>( to ) = *static_cast<const U*>( from ); }\n"
+			"	template<class U> typename std::enable_if<! std::is_copy_assignable<U>::value && std::is_move_assignable<U>::value>::type migrate( void *from, void *to, bool move ) { if( move ) *static_cast<U*>( to ) = std::move( *static_cast<U*>( from ) ); }\n"
+			"	template<class U> typename std::enable_if<! std::is_copy_assignable<U>::value && ! std::is_move_assignable<U>::value>::type migrate( void*, void*, bool ) {}\n"
+			"	template<class... U> struct Constructible : std::true_type {};\n"
+			"	template<class U, class... R> struct Constructible<U, R...> : std::integral_constant<bool, std::is_copy_constructible<U>::value && Constructible<R...>::value> {};\n"
+			"	template<class U> typename std::enable_if<std::is_copy_constructible<U>::value>::type construct( void *from, void *to, bool move ) { if( move ) new( to ) U( std::move( *static_cast<U*>( from ) ) ); else new( to ) U( *static_cast<const U*>( from ) ); }\n"
+			"	template<class U> typename std::enable_if<! std::is_copy_constructible<U>::value>::type construct( void*, void*, bool ) {}\n"
+			"}\n";
+}
+
+namespace detail {
+	//! Adds the fields and vtable pointers of \a record located at \a offset in the object, and the subobjects owning the vtable pointers to \a vtableOwners. Returns false if the class has virtual bases
+	inline bool addRecordLayout( const clang::ASTContext &context, const clang::CXXRecordDecl *record, size_t offset, ClassLayout *layout, std::vector<std::pair<size_t,const clang::CXXRecordDecl*>> *vtableOwners )
+	{
+		if( ! record || ! record->hasDefinition() || record->getNumVBases() ) {
+			return false;
+		}
+		
+		const auto &recordLayout = context.getASTRecordLayout( record );
+		if( record->isDynamicClass() && recordLayout.hasOwnVFPtr() ) {
+			layout->mVTablePointers.push_back( offset );
+			vtableOwners->push_back( std::make_pair( offset, record ) );
+		}
+		for( const auto &base : record->bases() ) {
+			auto baseRecord = base.getType()->getAsCXXRecordDecl();
+			if( base.isVirtual() || ! addRecordLayout( context, baseRecord, offset + recordLayout.getBaseClassOffset( baseRecord ).getQuantity(), layout, vtableOwners ) ) {
+				return false;
+			}
+		}
+		for( const auto *field : record->fields() ) {
+			size_t fieldOffset = offset + recordLayout.getFieldOffset( field->getFieldIndex() ) / context.getCharWidth();
+			auto type = field->getType();
+			layout->mFields.push_back( { record->getNameAsString() + "::" + field->getNameAsString(), type.getCanonicalType().getAsString(), fieldOffset, static_cast<size_t>( context.getTypeSizeInChars( type ).getQuantity() ),
+				field->isBitField(), type.isTriviallyCopyableType( context ), type->isPointerType() || type->isReferenceType() } );
+		}
+		return true;
+	}
+}
+
+//! Returns the layout of \a className in \a interpreter or an invalid layout if the class can't be found. The interpreter needs to be locked
+inline ClassLayout getClassLayout( cling::Interpreter *interpreter, const std::string &className )
+{
+	ClassLayout layout;
+	auto record = clang::dyn_cast_or_null<clang::CXXRecordDecl>( interpreter->getLookupHelper().findScope( className, cling::LookupHelper::NoDiagnostics ) );
+	auto &context = interpreter->getCI()->getASTContext();
+	std::vector<std::pair<size_t,const clang::CXXRecordDecl*>> vtableOwners;
+	if( record && detail::addRecordLayout( context, record, 0, &layout, &vtableOwners ) ) {
+		const auto &recordLayout = context.getASTRecordLayout( record );
+		layout.mSize = recordLayout.getSize().getQuantity();
+		layout.mAlignment = recordLayout.getAlignment().getQuantity();
+		
+		// a subobject shares its vtable pointer with the primary base at the same offset, the most derived one is added first
+		std::stable_sort( vtableOwners.begin(), vtableOwners.end(), []( const std::pair<size_t,const clang::CXXRecordDecl*> &a, const std::pair<size_t,const clang::CXXRecordDecl*> &b ) { return a.first < b.first; } );
+		vtableOwners.erase( std::unique( vtableOwners.begin(), vtableOwners.end(), []( const std::pair<size_t,const clang::CXXRecordDecl*> &a, const std::pair<size_t,const clang::CXXRecordDecl*> &b ) { return a.first == b.first; } ), vtableOwners.end() );
+		layout.mVTablePointers.clear();
+		for( const auto &owner : vtableOwners ) {
+			layout.mVTablePointers.push_back( owner.first );
+		}
+		
+		// the vtable pointers of an object point inside the vtable group of its class, at the address point of each subobject
+		if( record->isDynamicClass() && ! context.getTargetInfo().getCXXABI().isMicrosoft() ) {
+			auto vtableContext = static_cast<clang::ItaniumVTableContext*>( context.getVTableContext() );
+			const auto &vtableLayout = vtableContext->getVTableLayout( record );
+			for( const auto &owner : vtableOwners ) {
+				clang::BaseSubobject subobject( owner.second, clang::CharUnits::fromQuantity( owner.first ) );
+				layout.mVTableAddressPoints.push_back( static_cast<size_t>( vtableLayout.getAddressPoint( subobject ) ) );
+			}
+			std::unique_ptr<clang::MangleContext> mangleContext( context.createMangleContext() );
+			llvm::raw_string_ostream name( layout.mVTableName );
+			mangleContext->mangleCXXVTable( record, name );
+			name.flush();
+		}
+	}
+	return layout;
+}
+
+//! Returns the values of the vtable pointers of an object of the class described by \a layout, read from the vtable symbol of the class. Returns an empty vector if the vtable can't be found. The interpreter needs to be locked
+inline std::vector<void*> getVTables( cling::Interpreter *interpreter, const ClassLayout &layout )
+{
+	std::vector<void*> vtables;
+	if( layout.mVTableName.empty() || layout.mVTableAddressPoints.size() != layout.mVTablePointers.size() ) {
+		return vtables;
+	}
+	if( auto vtable = static_cast<void**>( interpreter->getAddressOfGlobal( layout.mVTableName ) ) ) {
+		for( size_t addressPoint : layout.mVTableAddressPoints ) {
+			vtables.push_back( vtable + addressPoint );
+		}
+	}
+	return vtables;
+}
+
+inline size_t SharedInterpreter::getHeapSize() const
+{
+	const auto &context = mInterpreter->getCI()->getASTContext();
+	return context.getASTAllocatedMemory() + context.getSideTableAllocatedMemory();
+}
+
+inline void SharedInterpreter::addIncludePath( const ci::fs::path &path )
+{
+	if( mIncludePaths.insert( path.string() ).second ) {
+		mInterpreter->AddIncludePath( path.string() );
+	}
+}
+
+inline void SharedInterpreter::loadFile( const ci::fs::path &path )
+{
+	if( mDynamicLibraries.insert( path.string() ).second ) {
+		ScopedMemoryMeasure measure( this );
+		mInterpreter->loadFile( path.string() );
+	}
+}
+
+inline void SharedInterpreter::declare( const std::string &declaration )
+{
+	if( mDeclarations.insert( declaration ).second ) {
+		ScopedMemoryMeasure measure( this );
+		mInterpreter->declare( declaration );
+	}
+}
+
+inline void SharedInterpreter::loadCinder()
+{
+	if( mCinderLoaded ) {
+		return;
+	}
+
+	ScopedMemoryMeasure measure( this );
+	auto blockPath = ci::fs::path( __FILE__ ).parent_path().parent_path();
+	mInterpreter->declare( "#define GLM_COMPILER 0" );
+	mInterpreter->AddIncludePath( blockPath.parent_path().parent_path().string() + "/include/" );
+#if defined(NDEBUG) || defined(_NDEBUG) || defined(RELEASE) || defined(MASTER) || defined(GOLD)
+	mInterpreter->loadFile( blockPath.parent_path().parent_path().string() + "/lib/libcinder.dylib" );
+#else
+	mInterpreter->loadFile( blockPath.parent_path().parent_path().string() + "/lib/libcinder_d.dylib" );
+#endif
+	mCinderLoaded = true;
+}
+
+inline std::vector<cling::Transaction*> SharedInterpreter::getTransactionsSince( const cling::Transaction *last ) const
+{
+	std::vector<cling::Transaction*> transactions;
+	auto transaction = last ? last->getNext() : const_cast<cling::Transaction*>( mInterpreter->getFirstTransaction() );
+	for( ; transaction; transaction = transaction->getNext() ) {
+		transactions.push_back( transaction );
+	}
+	return transactions;
+}
+
+inline size_t SharedInterpreter::release( const std::vector<cling::Transaction*> &transactions )
+{
+	mReleased.insert( transactions.begin(), transactions.end() );
+	
+	// unload from the end of the interpreter history for as long as the transactions there aren't needed anymore
+	ScopedMemoryMeasure measure( this );
+	size_t numUnloaded = 0;
+	while( auto last = mInterpreter->getLastTransaction() ) {
+		if( ! mReleased.erase( last ) ) {
+			break;
+		}
+		mInterpreter->unload( *const_cast<cling::Transaction*>( last ) );
+		numUnloaded++;
+	}
+	mNumUnloaded += numUnloaded;
+	return numUnloaded;
+}
+
+inline SharedInterpreterRef InterpreterPool::acquire( const std::vector<std::string> &args, const std::string &owner )
+{
+	std::string key = owner;
+	for( const auto &arg : args ) {
+		key += " " + arg;
+	}
+
+	std::lock_guard<std::mutex> lock( mMutex );
+	auto &interpreter = mInterpreters[key];
+	if( ! interpreter ) {
+		interpreter = std::make_shared<SharedInterpreter>( args );
+	}
+	interpreter->mNumClasses++;
+	return interpreter;
+}
+
+inline std::vector<SharedInterpreterRef> InterpreterPool::getInterpreters() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	std::vector<SharedInterpreterRef> interpreters;
+	for( const auto &interpreter : mInterpreters ) {
+		interpreters.push_back( interpreter.second );
+	}
+	return interpreters;
+}
+
+} // namespace runtime
@@ -25,15 +25,32 @@
 
 #include <memory>
 
+#include "runtime_reclaimer.h"
+
 #if ! defined( DISABLE_RUNTIME_COMPILATION ) && ! defined( DISABLE_RUNTIME_COMPILED_PTR )
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <map>
+#include <mutex>
 
+#include "cinder/app/App.h"
 #include "cinder/Exception.h"
 #include "cinder/Filesystem.h"
+#include "cinder/Log.h"
 #include "cinder/System.h"
 #include "cling/Interpreter/Interpreter.h"
-#include "Watchdog.h"
+#include "runtime_compiler.h"
+#include "runtime_watcher.h"
+#include "runtime_includes.h"
+#include "runtime_source.h"
+#include "runtime_transaction.h"
+#include "runtime_interpreter.h"
+#include "runtime_tasks.h"
 
 #ifdef RUNTIME_PTR_CEREALIZATION
 #include <utility>
@@ -46,11 +63,12 @@ class runtime_class;
 template<class T>
 class runtime_ptr {
 public:
-	constexpr runtime_ptr() {}
+	constexpr runtime_ptr() : mRawPtr( nullptr ), mPrevInstance( nullptr ), mNextInstance( nullptr ), mGeneration( 0 ) {}
 	
-	operator bool() const { return mPtr.operator bool(); }
-	T* operator->() const { return mPtr.operator->(); }
-	T* get() const { return mPtr.get(); }
+	//! Access to the instance is safe from any thread while it's being swapped, see runtime::Reclaimer
+	operator bool() const { return get() != nullptr; }
+	T* operator->() const { return get(); }
+	T* get() const { return mRawPtr.load( std::memory_order_acquire ); }
 	long use_count() const { return mPtr.use_count(); }
 	
 	runtime_ptr( const runtime_ptr& other );
@@ -61,7 +79,6 @@ public:
 	
 protected:
 	friend class runtime_class<T>;
-	std::string getName() const;
 	void update( const std::shared_ptr<T> &newInstance );
 	
 	runtime_ptr( bool runtime );
@@ -78,11 +95,13 @@ protected:
 	
 	template<class U, class Enable = void>
 	struct Cerealizer {
+		static bool isSupported() { return false; }
 		template<class Archive> void save( U* ptr, Archive& ){}
 		template<class Archive>	void load( U* ptr, Archive& ){}
 	};
 	template<class U>
 	struct Cerealizer<U,typename std::enable_if<SupportsCerealSave<U,void(cereal::BinaryOutputArchive&)>::value && SupportsCerealLoad<U,void(cereal::BinaryInputArchive&)>::value>::type> {
+		static bool isSupported() { return true; }
 		template<class Archive> void save( U* ptr, Archive &ar ){ ptr->save( ar ); }
 		template<class Archive> void load( U* ptr, Archive &ar ){ ptr->load( ar ); }
 	protected:
@@ -92,49 +111,273 @@ protected:
 #endif
 	
 	std::shared_ptr<T> mPtr;
+	// read by the accessors without touching the reference count of mPtr, which is only modified by the owning thread
+	std::atomic<T*> mRawPtr;
+	// intrusive list of the instances registered to runtime_class<T>
+	runtime_ptr *mPrevInstance, *mNextInstance;
+	// index of the last swap applied to the instance
+	uint32_t mGeneration;
 };
 
 template<class T>
 runtime_ptr<T> make_runtime() {	return runtime_ptr<T>( true ); }
 
+//! Array of instances stored contiguously in a single allocation. All the instances share the same generation and are
+//! swapped together, which keeps iterating over large numbers of objects cache friendly
+template<class T>
+class runtime_vector {
+public:
+	runtime_vector() : mData( nullptr ), mSize( 0 ), mStride( sizeof( T ) ), mPrevVector( nullptr ), mNextVector( nullptr ), mGeneration( 0 ) {}
+	//! Creates \a count default constructed instances
+	explicit runtime_vector( size_t count );
+	~runtime_vector();
+	
+	runtime_vector( const runtime_vector& ) = delete;
+	runtime_vector& operator=( const runtime_vector& ) = delete;
+	//! Takes the instances of \a other, which is left empty
+	runtime_vector( runtime_vector &&other );
+	runtime_vector& operator=( runtime_vector &&other );
+	
+	size_t size() const { return mSize; }
+	bool empty() const { return mSize == 0; }
+	T& operator[]( size_t index ) { return *reinterpret_cast<T*>( reinterpret_cast<char*>( mData ) + index * mStride ); }
+	const T& operator[]( size_t index ) const { return *reinterpret_cast<const T*>( reinterpret_cast<const char*>( mData ) + index * mStride ); }
+	
+	//! Calls \a method on every instance, discarding what it returns. Virtual methods are resolved once for the whole array with the Itanium C++ ABI, and per instance otherwise
+	template<class R, class... Args, class... Params>
+	void forEach( R (T::*method)( Args... ), Params&&... params );
+	//! Calls the const \a method on every instance, discarding what it returns
+	template<class R, class... Args, class... Params>
+	void forEach( R (T::*method)( Args... ) const, Params&&... params ) const;
+	template<class R, class... Args, class... Params>
+	void forEach( R (T::*method)( Args... ) const, Params&&... params ) { static_cast<const runtime_vector&>( *this ).forEach( method, std::forward<Params>( params )... ); }
+	//! Calls \a fn with a reference to every instance
+	template<class Fn>
+	void forEach( const Fn &fn );
+	
+protected:
+	friend class runtime_class<T>;
+	//! Returns the address of the function called by \a method on \a object and the adjustment of its this pointer, or nullptr if the ABI isn't supported
+	template<class Method>
+	static void* resolveMethod( const T *object, Method method, ptrdiff_t &adjustment );
+	
+	// the instances might be of a larger generation, hence the stride
+	std::shared_ptr<T> mBlock;
+	T* mData;
+	size_t mSize, mStride;
+	// intrusive list of the vectors registered to runtime_class<T>
+	runtime_vector *mPrevVector, *mNextVector;
+	// index of the last swap applied to the instances
+	uint32_t mGeneration;
+};
+
 template<class T>
 class runtime_class {
 public:
+	//! Specifies when the interpreter is created and the original code compiled. Until then the instances are plain native objects
+	enum class WarmUp {
+		//! During initialize, on the calling thread
+		IMMEDIATE,
+		//! On the compile thread, right after initialize
+		BACKGROUND,
+		//! Only once the code actually changes
+		ON_FIRST_CHANGE
+	};
+	
 	class Options {
 	public:
-		Options() : mLoadCinder( false ) {}
+		Options() : mLoadCinder( false ), mCoalescingWindow( 0.1 ), mOptimizationLevel( runtime::getDefaultOptimizationLevel() ), mTieredCompilation( false ), mSharedInterpreter( false ), mWarmUp( WarmUp::IMMEDIATE ), mObjectCache( false ), mMaxOldGenerations( 4 ), mInPlaceSwap( true ), mStateMigration( true ), mSwapBudget( 0.0 ), mStandard( "c++11" ) {}
 		
 		Options& includePath( const ci::fs::path &path );
 		Options& dynamicLibrary( const ci::fs::path &path );
 		Options& cinder();
 		Options& declaration( const std::string &declaration );
+		//! Specifies how long to wait for the file to stop changing before recompiling it. Defaults to 0.1 seconds
+		Options& coalescingWindow( double seconds );
+		//! Specifies the optimization level of the jit-compiled code. Defaults to 2 in release and 0 in debug
+		Options& optimizationLevel( int level );
+		//! Specifies the language standard passed to the interpreter. Defaults to "c++11"
+		Options& standard( const std::string &standard );
+		//! Adds flags to the interpreter command line, ie. "-march=native -ffast-math"
+		Options& compilerFlags( const std::string &flags );
+		//! Swaps an unoptimized version of the code as soon as possible, then the version compiled with the optimization level once it's ready
+		Options& tieredCompilation( bool tiered = true );
+		//! Specifies whether the class can share its interpreter with the other classes using the same compiler flags. The code of those classes then lives in the same RuntimeBase namespace, so their names must not clash. Defaults to false
+		Options& sharedInterpreter( bool shared = true );
+		//! Specifies when the interpreter is warmed up. Defaults to WarmUp::IMMEDIATE. With WarmUp::BACKGROUND and WarmUp::ON_FIRST_CHANGE initialize returns nullptr,
+		//! make_runtime keeps creating native instances until the first edit of the file is compiled, and with ON_FIRST_CHANGE that first reload also waits for the warm up
+		Options& warmUp( WarmUp mode );
+		//! Adds a header to the precompiled header loaded by the interpreter, ie. "cinder/app/App.h". The precompiled header is cached on disk and rebuilt when one of its files changes
+		Options& precompiledHeader( const std::string &header );
+		//! Specifies whether the implementation of the original code is compiled to a library cached between runs of the app. Only applies to classes with a .cpp file
+		Options& objectCache( bool cache = true );
+		//! Specifies how many superseded generations the class keeps before releasing the ones no instance uses anymore. Defaults to 4. This doesn't bound
+		//! the memory of the interpreter: cling can only unload the code it processed last, so a generation that got applied stays loaded for as long as
+		//! the newer ones do, which is until the app quits. Only the generations that were never applied and the migration code end up unloaded. With
+		//! tieredCompilation each save adds two generations
+		Options& maxOldGenerations( size_t count );
+		//! Specifies whether instances are switched to the new generation without being recreated when its memory layout didn't change. The constructor isn't called again and the state is kept as is. Only applies while every thread registered
+		//! with runtime::Reclaimer is offline, ie. sleeping in the TaskPool, otherwise they are rebuilt with their members copied. Defaults to true
+		Options& inPlaceSwap( bool inPlace = true );
+		//! Specifies whether the members that kept the same name and type are moved to the new instances when the layout changes, shared_ptrs and containers included. They are
+		//! only moved while every thread registered with runtime::Reclaimer is offline, ie. sleeping in the TaskPool, and copied otherwise. Defaults to true
+		Options& stateMigration( bool migrate = true );
+		//! Specifies how many seconds per frame can be spent swapping the instances to a new generation. Large reloads are then spread over several frames. Defaults to 0, swapping everything at once
+		Options& swapBudget( double seconds );
+		//! Adds the class to the classes reloaded as a single transaction under \a group. They are compiled together and swapped in the same frame, or not at all if one of them fails to compile
+		Options& reloadGroup( const std::string &group );
 		
 		const std::vector<ci::fs::path>& getIncludePaths() const { return mIncludePaths; }
 		const std::vector<ci::fs::path>& getDynamicLibraries() const { return mDynamicLibraries; }
 		const std::vector<std::string>& getDeclarations() const { return mDeclarations; }
 		bool needsCinder() const { return mLoadCinder; }
+		double getCoalescingWindow() const { return mCoalescingWindow; }
+		int getOptimizationLevel() const { return mOptimizationLevel; }
+		const std::string& getStandard() const { return mStandard; }
+		const std::vector<std::string>& getCompilerFlags() const { return mCompilerFlags; }
+		bool isTieredCompilationEnabled() const { return mTieredCompilation; }
+		bool isInterpreterShared() const { return mSharedInterpreter; }
+		WarmUp getWarmUp() const { return mWarmUp; }
+		const std::vector<std::string>& getPrecompiledHeaders() const { return mPrecompiledHeaders; }
+		bool isObjectCacheEnabled() const { return mObjectCache; }
+		size_t getMaxOldGenerations() const { return mMaxOldGenerations; }
+		bool isInPlaceSwapEnabled() const { return mInPlaceSwap; }
+		bool isStateMigrationEnabled() const { return mStateMigration; }
+		double getSwapBudget() const { return mSwapBudget; }
+		const std::string& getReloadGroup() const { return mReloadGroup; }
 		
 	protected:
 		bool mLoadCinder;
+		double mCoalescingWindow;
+		int mOptimizationLevel;
+		bool mTieredCompilation;
+		bool mSharedInterpreter;
+		WarmUp mWarmUp;
+		bool mObjectCache;
+		size_t mMaxOldGenerations;
+		bool mInPlaceSwap;
+		bool mStateMigration;
+		double mSwapBudget;
+		std::string mReloadGroup;
+		std::string mStandard;
+		std::vector<std::string> mCompilerFlags;
 		std::vector<ci::fs::path> mIncludePaths;
 		std::vector<ci::fs::path> mDynamicLibraries;
 		std::vector<std::string> mDeclarations;
+		std::vector<std::string> mPrecompiledHeaders;
 	};
 	
+	//! Starts watching the source of the class. Returns the interpreter, or nullptr if Options::warmUp deferred its creation, which is
+	//! always the case with WarmUp::BACKGROUND and WarmUp::ON_FIRST_CHANGE even if the warm up ends soon after. isWarm() tells when it's ready
 	static std::shared_ptr<cling::Interpreter> initialize( const ci::fs::path &path, const Options &options = Options() );
+	//! Creates the interpreter and compiles the original code if it hasn't been done yet
+	static void warmUp();
+	//! Returns whether the interpreter is ready to compile new generations of the class
+	static bool isWarm() { return instance()->mWarm; }
+	
+	//! Swaps the instances to the last generation compiled on the compile thread. Automatically called at the start of each app update
+	static void applyPending();
+	//! Returns whether a compiled generation is waiting to be applied to the instances
+	static bool hasPending();
+	//! Returns whether the instances are being swapped to a new generation over several frames, see Options::swapBudget
+	static bool isSwapping() { return instance()->mSwap.mInProgress; }
+	//! Returns the fraction of the instances already swapped to the generation being applied, 1 when no swap is in progress
+	static double getSwapProgress();
+	//! Emitted on the main thread once every instance has been swapped to a new generation
+	static ci::signals::Signal<void()>& getSignalSwapped() { return instance()->mSignalSwapped; }
+	//! Emitted on the main thread when a new version of the code fails to compile, with the errors reported by the interpreter. The instances keep using the last generation that compiled
+	static ci::signals::Signal<void(const std::vector<runtime::Diagnostic>&)>& getSignalCompileFailed() { return instance()->mSignalCompileFailed; }
+	//! Returns the diagnostics reported by the interpreter during the last compilation
+	static std::vector<runtime::Diagnostic> getDiagnostics();
+	//! Returns the number of compilations that failed
+	static size_t getNumFailedCompilations() { return instance()->mNumFailedCompilations; }
+	//! Calls \a fn on every instance, including the ones of runtime_vectors, spread over the threads of runtime::TaskPool in
+	//! batches of \a grainSize instances. The instances aren't swapped while it runs. A swap spread over several frames is completed
+	//! first so all of them are of the same generation, unless the compile thread holds the interpreter, in which case it goes on in the next frames
+	static void parallelForEach( const std::function<void(T&)> &fn, size_t grainSize = 64 );
+	//! Returns the number of reloads that were skipped because the code didn't change since the last successful compilation
+	static size_t getNumSkippedReloads() { return instance()->mNumSkippedReloads; }
+	//! Returns the time in seconds between the start of the last compilation and the swap of its unoptimized version
+	static double getFastTierLatency() { return instance()->mFastTierLatency; }
+	//! Returns the time in seconds between the start of the last compilation and the swap of its optimized version
+	static double getOptimizedTierLatency() { return instance()->mOptimizedTierLatency; }
+	//! Returns the number of generations of the class kept by the class, the current one included
+	static size_t getNumGenerations();
+	//! Returns the number of generations released by the class. A released generation is only unloaded from the interpreter once everything
+	//! processed after it has been released too, see Options::maxOldGenerations and SharedInterpreter::getNumUnloadedTransactions
+	static size_t getNumReleasedGenerations() { return instance()->mNumReleasedGenerations; }
+	
+	//! Ways of transferring the state of an instance to a new generation, from the cheapest to the most expensive
+	enum class Transfer {
+		//! The layout didn't change, the instance is switched to the new generation in place
+		IN_PLACE,
+		//! The members of the previous instance that can be copied with memcpy are copied to a new instance
+		MEMCPY,
+		//! The members of the previous instance are copied or moved to a new instance by code generated for both layouts
+		FIELDS,
+		//! The previous instance is saved and loaded in the new one with cereal
+		CEREAL,
+		//! A new instance is created without its previous state
+		RECREATE
+	};
+	//! Returns the number of instances that have been transferred with \a transfer
+	static size_t getNumTransfers( Transfer transfer ) { return instance()->mNumTransfers[static_cast<size_t>( transfer )]; }
+	//! Returns the name of \a transfer
+	static const char* getTransferName( Transfer transfer );
+	//! Returns the memory layout of the last generation applied to the instances
+	static const runtime::ClassLayout& getLayout() { return instance()->mLayout; }
+	//! Returns the fingerprint of the memory layout of the last generation applied to the instances
+	static uint64_t getLayoutFingerprint() { return getLayout().getFingerprint(); }
+	//! Returns the interpreter used by this class, which might be shared with other classes
+	static runtime::SharedInterpreterRef getSharedInterpreter() { return instance()->mSharedInterpreter; }
 	
 protected:
+	runtime_class() : mInitialized( false ), mWarm( false ), mFirstInstance( nullptr ), mFirstVector( nullptr ), mNumReleasedGenerations( 0 ), mNumTransfers(), mSignalSwappedPending( false ), mCompileFailed( false ), mNumFailedCompilations( 0 ), mSourceHash( 0 ), mNumSkippedReloads( 0 ), mOptimizationLevel( 0 ), mTieredCompilation( false ), mFastTierLatency( 0.0 ), mOptimizedTierLatency( 0.0 ) {}
+	
+	struct Generation;
+	struct LoadedGeneration;
 	
+	static void watchSources( const ci::fs::path &absolutePath, const std::string &className, bool isCpp, const std::vector<std::string> &includes );
+	static runtime::ReloadTransactions::CompileResult compileGeneration( const ci::fs::path &absolutePath, const std::string &className, bool isCpp, bool transaction );
+	static runtime::ReloadTransactions::CompileResult compileOptimizedTier( bool transaction );
+	static bool declareGeneration( const std::string &className, const std::string &includesString, std::string code, uint64_t sourceHash, int optimizationLevel, bool optimizedTier, const std::chrono::steady_clock::time_point &startTime, Generation &generation );
+	static void publishGeneration( Generation &generation );
+	static void discardGeneration( Generation &generation );
+	static void addToReloadTransactions( const std::string &className );
+	static bool startSwap();
+	static void unloadGenerations();
+	static void registerLayout( void *vtable, const runtime::ClassLayout &layout );
+	static const runtime::ClassLayout* findLayout( const T *object );
+	//! \a inPlace tells whether no other thread can be reading the instances, see runtime::Reclaimer::beginExclusive
+	static Transfer selectTransfer( const T *object, const Generation &generation, bool inPlace );
 	static void addIncludePath( const ci::fs::path &path );
 	static void loadFile( const ci::fs::path &path );
 	static void loadCinder();
 	static void declare( const std::string &declaration );
 	
+	static void autoInitialize();
 	static void registerInstance( runtime_ptr<T>* ptr );
 	static void unregisterInstance( runtime_ptr<T>* ptr );
+	static bool isRegistered( const runtime_ptr<T>* ptr ) { return ptr->mPrevInstance || instance()->mFirstInstance == ptr; }
+	static void registerVector( runtime_vector<T>* vector );
+	static void unregisterVector( runtime_vector<T>* vector );
+	static bool continueSwap( double budget );
+	//! Returns false if the instances of \a vector couldn't be built by the generation, in which case they stay on their current generation
+	static bool swapVector( runtime_vector<T>* vector, Generation &generation, std::vector<void*> &vtables, void *&vtable, LoadedGeneration &loadedGeneration, bool exclusive, Transfer &transfer );
+	static void transferState( Transfer transfer, T *from, T *to, Generation &generation, bool move );
+	static std::shared_ptr<T> constructInstances( T *from, size_t count, const Generation &generation, bool move );
+	//! Returns whether the members of \a object can be moved to its new instance, which requires that nothing else can reach it. Another thread might
+	//! still be reading it through a raw pointer unless the swap runs in an exclusive section of the runtime::Reclaimer
+	static bool isUnreachable( const std::shared_ptr<T> &object, bool exclusive ) { return object.use_count() == 1 && exclusive; }
 	static std::shared_ptr<cling::Interpreter> getInterpreter();
+	//! The interpreter is shared between the compile thread, the main thread and the other classes compiled with the same flags. Only valid once warm
+	static std::recursive_mutex& getInterpreterMutex() { return instance()->mSharedInterpreter->getMutex(); }
+	//! Looks for a .cpp or a .h named after the class
+	static ci::fs::path findSourcePath();
+	static void connectUpdate();
 	
 	friend class runtime_ptr<T>;
+	friend class runtime_vector<T>;
 	
 	static const std::unique_ptr<runtime_class>& instance() { static std::unique_ptr<runtime_class> inst = std::unique_ptr<runtime_class>( new runtime_class() ); return inst; }
 	
@@ -160,8 +403,122 @@ protected:
 		return ci::fs::path();
 	}
 	
+	runtime::SharedInterpreterRef mSharedInterpreter;
 	std::shared_ptr<cling::Interpreter> mInterpreter;
-	std::map<runtime_ptr<T>*,std::function<void(const std::shared_ptr<T>&)>> mInstances;
+	
+	// the interpreter is created lazily from the code the app was built with
+	std::mutex mInitMutex, mWarmUpMutex;
+	std::atomic<bool> mInitialized;
+	std::atomic<bool> mWarm;
+	Options mOptions;
+	ci::fs::path mPath;
+	std::string mBaseIncludes, mBaseCode, mBaseDeclarations;
+	// heads of the lists of instances and vectors linked through the runtime_ptrs and runtime_vectors themselves
+	runtime_ptr<T> *mFirstInstance;
+	runtime_vector<T> *mFirstVector;
+	// guards both lists, recursive as the constructors called while swapping can create runtime_ptrs of their own
+	std::recursive_mutex mListMutex;
+	// held while the instances are swapped or used by parallelForEach
+	std::mutex mSwapMutex;
+	
+	// last compiled generation, waiting to be applied to the instances
+	typedef void (*MigrationFn)( void*, void*, bool );
+	typedef bool (*ConstructFn)( void*, void*, bool );
+	typedef void (*DestroyFn)( void*, size_t );
+	typedef void (*FactoryFn)( void*, size_t );
+	typedef void* (*ArrayFactoryFn)( size_t );
+	typedef void (*ArrayDeleterFn)( void* );
+	struct Generation {
+		Generation() : mSourceHash( 0 ), mFactory( nullptr ), mArrayFactory( nullptr ), mArrayDeleter( nullptr ), mDestroyer( nullptr ), mOptimizedTier( false ) {}
+		std::string								mNamespace;
+		// transactions processed by the interpreter for the generation, released together
+		std::vector<cling::Transaction*>		mTransactions;
+		// hash of the code the generation was compiled from
+		uint64_t								mSourceHash;
+		// fills an array of std::shared_ptr<T> with new instances of the generation
+		FactoryFn								mFactory;
+		// allocate and destroy contiguous arrays of instances for runtime_vector
+		ArrayFactoryFn							mArrayFactory;
+		ArrayDeleterFn							mArrayDeleter;
+		// destroys and frees instances constructed in raw memory by mConstructors
+		DestroyFn								mDestroyer;
+		runtime::ClassLayout					mLayout;
+		// values of the vtable pointers of the instances, resolved from the vtable symbol of the class
+		std::vector<void*>						mVTables;
+		// functions copying the members of the instances to a new instance of the generation, by fingerprint of their layout
+		std::map<uint64_t,MigrationFn>			mMigrations;
+		// functions building a new instance from every member of the previous one, without running its constructor
+		std::map<uint64_t,ConstructFn>			mConstructors;
+		// transactions of the migration code, released once the generation has been applied
+		std::vector<cling::Transaction*>		mMigrationTransactions;
+		bool									mOptimizedTier;
+		std::chrono::steady_clock::time_point	mStartTime;
+	};
+	std::mutex mPendingMutex;
+	Generation mPending;
+	// generation compiled as part of a reload transaction, committed once the other classes of the transaction compiled
+	// and published when the transaction is applied. Only used with the interpreter locked
+	Generation mPrepared, mCommitted;
+	// code of the last generation compiled without optimizations, compiled again by the optimized tier. Only used on the compile thread
+	struct TierSource {
+		TierSource() : mSourceHash( 0 ) {}
+		std::string								mClassName, mIncludes, mCode;
+		uint64_t								mSourceHash;
+		std::chrono::steady_clock::time_point	mStartTime;
+	};
+	TierSource mTierSource;
+	
+	// generations loaded in the interpreter, oldest first, with the instances they created
+	struct LoadedGeneration {
+		std::vector<cling::Transaction*>		mTransactions;
+		void*									mVTable;
+		std::vector<std::weak_ptr<T>>			mInstances;
+	};
+	std::deque<LoadedGeneration> mGenerations;
+	std::atomic<size_t> mNumReleasedGenerations;
+	
+	// layouts of the native class, of the generations applied to the instances, identified by their vtable,
+	// and of the last one. Only used while the interpreter is locked
+	static const size_t sNumTransfers = 5;
+	runtime::ClassLayout mBaseLayout, mLayout;
+	std::map<void*,runtime::ClassLayout> mLayouts;
+	std::array<size_t,sNumTransfers> mNumTransfers;
+	ci::signals::Connection mUpdateConnection;
+	
+	// generation being applied to the instances, possibly over several frames. Each instance remembers the index of the
+	// last swap it went through. Only used with mSwapMutex locked
+	struct Swap {
+		Swap() : mInProgress( false ), mIndex( 0 ), mVTable( nullptr ), mNumSwapped( 0 ), mNumRemaining( 0 ), mRecreateCost( 0.0 ), mNumTransfers(), mDurations() {}
+		bool								mInProgress;
+		uint32_t							mIndex;
+		Generation							mGeneration;
+		LoadedGeneration					mLoaded;
+		std::vector<void*>					mVTables;
+		void*								mVTable;
+		size_t								mNumSwapped, mNumRemaining;
+		// average time it took to recreate an instance, used to plan the next batch
+		double								mRecreateCost;
+		std::array<size_t,sNumTransfers>	mNumTransfers;
+		std::array<double,sNumTransfers>	mDurations;
+	};
+	Swap mSwap;
+	ci::signals::Signal<void()> mSignalSwapped;
+	// set when parallelForEach completed a swap on another thread, the signal is then emitted by the next applyPending
+	std::atomic<bool> mSignalSwappedPending;
+	
+	// diagnostics of the last compilation, a failure is reported by the next applyPending unless a newer version compiled meanwhile. Guarded by mPendingMutex
+	std::vector<runtime::Diagnostic> mDiagnostics;
+	bool mCompileFailed;
+	std::atomic<size_t> mNumFailedCompilations;
+	ci::signals::Signal<void(const std::vector<runtime::Diagnostic>&)> mSignalCompileFailed;
+	
+	// hash of the code of the last successful compilation
+	uint64_t mSourceHash;
+	std::atomic<size_t> mNumSkippedReloads;
+	
+	int mOptimizationLevel;
+	bool mTieredCompilation;
+	double mFastTierLatency, mOptimizedTierLatency;
 };
 
 
@@ -195,11 +552,98 @@ typename runtime_class<T>::Options& runtime_class<T>::Options::declaration( cons
 	mDeclarations.push_back( declaration );
 	return *this;
 }
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::coalescingWindow( double seconds )
+{
+	mCoalescingWindow = seconds;
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::optimizationLevel( int level )
+{
+	mOptimizationLevel = level;
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::standard( const std::string &standard )
+{
+	mStandard = standard;
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::compilerFlags( const std::string &flags )
+{
+	mCompilerFlags.push_back( flags );
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::tieredCompilation( bool tiered )
+{
+	mTieredCompilation = tiered;
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::sharedInterpreter( bool shared )
+{
+	mSharedInterpreter = shared;
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::warmUp( WarmUp mode )
+{
+	mWarmUp = mode;
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::precompiledHeader( const std::string &header )
+{
+	mPrecompiledHeaders.push_back( header );
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::objectCache( bool cache )
+{
+	mObjectCache = cache;
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::maxOldGenerations( size_t count )
+{
+	mMaxOldGenerations = count;
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::inPlaceSwap( bool inPlace )
+{
+	mInPlaceSwap = inPlace;
+	return *this;
+}
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::stateMigration( bool migrate )
+{
+	mStateMigration = migrate;
+	return *this;
+}
+
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::swapBudget( double seconds )
+{
+	mSwapBudget = seconds;
+	return *this;
+}
+
+template<class T>
+typename runtime_class<T>::Options& runtime_class<T>::Options::reloadGroup( const std::string &group )
+{
+	mReloadGroup = group;
+	return *this;
+}
 
 template<class T>
 std::shared_ptr<cling::Interpreter> runtime_class<T>::initialize( const ci::fs::path &path, const Options &options )
 {
-	if( ! instance()->mInterpreter ) {
+	std::unique_lock<std::mutex> initLock( instance()->mInitMutex );
+	if( ! instance()->mInitialized ) {
 		
 		// find the actual path
 		ci::fs::path absolutePath;
@@ -215,316 +659,1259 @@ std::shared_ptr<cling::Interpreter> runtime_class<T>::initialize( const ci::fs::
 			absolutePath = ci::fs::canonical( ci::fs::current_path() / "../../../include" / path );
 		}
 		
-		// initialize cling interpreter
-		const char * args[] = { "-std=c++11" };
-		auto blockPath = ci::fs::path( __FILE__ ).parent_path().parent_path();
-		instance()->mInterpreter = std::make_shared<cling::Interpreter>( 1, args, ( blockPath.string() + "/lib/" ).c_str() );
-		
-		// add the parent path to the include paths
-		instance()->mInterpreter->AddIncludePath( absolutePath.parent_path().string() );
-		
-		// process the class options
-		for( const auto &p : options.getIncludePaths() ) {
-			addIncludePath( p );
-		}
-		for( const auto &p : options.getDynamicLibraries() ) {
-			loadFile( p );
-		}
-		for( const auto &d : options.getDeclarations() ) {
-			declare( d );
-		}
-		if( options.needsCinder() ) {
-			loadCinder();
-		}
-		
-		// compile the original class
+		// the original class is only compiled once the interpreter is warmed up
 		bool isCpp = absolutePath.extension() == ".cpp";
-		ci::fs::path headerPath = absolutePath.parent_path() / ( absolutePath.stem().string() + ".h" );
-		ci::fs::path implPath = absolutePath.parent_path() / ( absolutePath.stem().string() + ".cpp" );
 		
-		// copy the file content to a string
-		std::string originalCode;
-		std::vector<std::string> includes;
+		// split the includes from the code, keeping the content of the header apart
+		auto source = runtime::SourceAssembler::get().assembleClass( absolutePath );
+		const std::vector<std::string> &includes = source.mIncludes;
+		const std::string &includesString = source.mIncludesString;
+		const std::string &originalCode = source.mCode;
+		const std::string &declarations = source.mDeclarations;
 		
-		// if it's a header just copy it like this
-		if( !isCpp ) {
-			std::ifstream infile( headerPath.c_str() );
-			std::string line;
-			while( std::getline( infile, line ) ) {
-				//originalCode += line + " \n";
-				if( line.find( "#include" ) == std::string::npos ) {
-					originalCode += line + " \n";
-				}
-				else includes.push_back( line );
-			}
-		}
-		// otherwise remove the include in the cpp file and prepend the header before the implementation
-		else {
-			std::string line;
-			std::ifstream headerFile( headerPath.c_str() );
-			while( std::getline( headerFile, line ) ) {
-				//originalCode += line + " \n";
-				if( line.find( "#include" ) == std::string::npos ) {
-					originalCode += line + " \n";
-				}
-				else includes.push_back( line );
-			}
-			std::ifstream implFile( implPath.c_str() );
-			while( std::getline( implFile, line ) ) {
-				// skip the header include
-				if( !( line.find( "#include" ) != std::string::npos && line.find( headerPath.filename().string() ) != std::string::npos ) ) {
-					//originalCode += line + " \n";
-					if( line.find( "#include" ) == std::string::npos ) {
-						originalCode += line + " \n";
-					}
-					else includes.push_back( line );
-				}
-			}
+		// keep the code the app was built with, the file might already have been edited when the interpreter warms up
+		instance()->mOptions = options;
+		instance()->mPath = absolutePath;
+		instance()->mBaseIncludes = includesString;
+		instance()->mBaseCode = originalCode;
+		instance()->mBaseDeclarations = declarations;
+		instance()->mSourceHash = runtime::hash( includesString + originalCode );
+		instance()->mOptimizationLevel = options.getOptimizationLevel();
+		instance()->mTieredCompilation = options.isTieredCompilationEnabled();
+		instance()->mInitialized = true;
+		
+		// swap the compiled generations on the main thread at the start of each frame
+		if( ! runtime::CompileWorker::get().isCompileThread() ) {
+			connectUpdate();
 		}
 		
-		// prepend the includes
-		std::string includesString;
-		for( auto inc : includes ) {
-			includesString += inc + "\n";
+		// warm up the interpreter now, on the compile thread or once the file changes
+		if( options.getWarmUp() == WarmUp::BACKGROUND ) {
+			runtime::CompileWorker::get().enqueue( [](){ warmUp(); } );
 		}
 		
-		// wrap original code in its own namespace
-		originalCode = includesString + "\n\nnamespace RuntimeBase {\n" + originalCode + "\n};";
+		// any class can be reloaded as part of a transaction, the classes of a reload group always are
+		addToReloadTransactions( ci::System::demangleTypeName( typeid( T ).name() ) );
 		
-		// process the original code once
-		instance()->mInterpreter->enableRawInput();
-		instance()->mInterpreter->declare( originalCode );
-		instance()->mInterpreter->enableRawInput( false );
-		instance()->mInterpreter->declare( "#include <memory>" );
+		// start watching the files and the project headers they include
+		watchSources( absolutePath, ci::System::demangleTypeName( typeid( T ).name() ), isCpp, includes );
 		
-		// start watching file
-		std::string className = ci::System::demangleTypeName( typeid( T ).name() );
-		wd::watch( absolutePath, [absolutePath,className,isCpp]( const ci::fs::path& ) {
-			// copy the file content to a string
-			std::string code;
-			std::vector<std::string> includes;
-			
-			// if it's a header just copy it like this
-			if( !isCpp ) {
-				std::ifstream infile( absolutePath.c_str() );
-				std::string line;
-				while( std::getline( infile, line ) ) {
-					//code += line + " \n";
-					if( line.find( "#include" ) == std::string::npos ) {
-						code += line + " \n";
-					}
-					else includes.push_back( line );
-				}
-			}
-			// otherwise remove the include in the cpp file and prepend the header before the implementation
-			else {
-				std::string stem = absolutePath.stem().string();
-				ci::fs::path header = absolutePath.parent_path() / ( stem + ".h" );
-				ci::fs::path impl = absolutePath.parent_path() / ( stem + ".cpp" );
-				
-				std::string line;
-				std::ifstream headerFile( header.c_str() );
-				while( std::getline( headerFile, line ) ) {
-					//code += line + " \n";
-					if( line.find( "#include" ) == std::string::npos ) {
-						code += line + " \n";
-					}
-					else includes.push_back( line );
-				}
-				std::ifstream implFile( impl.c_str() );
-				while( std::getline( implFile, line ) ) {
-					// skip the header include
-					if( !( line.find( "#include" ) != std::string::npos && line.find( header.filename().string() ) != std::string::npos ) ) {
-						//code += line + " \n";
-						if( line.find( "#include" ) == std::string::npos ) {
-							code += line + " \n";
-						}
-						else includes.push_back( line );
-					}
-				}
-			}
-			
-			// prepend the includes
-			std::string includesString;
-			for( auto inc : includes ) {
-				includesString += inc + "\n";
-			}
-			
-			// make a unique namespace name
-			std::string uniqueNamespace;
-			instance()->mInterpreter->createUniqueName( uniqueNamespace );
-			uniqueNamespace = className + uniqueNamespace;
-			
-			// wrap the code in its own unique namespace
-			code = includesString + "\n\nnamespace " + uniqueNamespace + " {\n" + code + "\n};";
-			
-			// Make the class inherit from the original one
-			size_t pos = code.find( "class " + className + " { " );
-			if( pos != std::string::npos ) {
-				code.replace( pos, ( "class " + className + " { " ).length(), "class " + className + " : public RuntimeBase::" + className + " { " );
-			}
-			else {
-				pos = code.find( "class " + className + " : " );
-				if( pos != std::string::npos ) {
-					code.replace( pos, ( "class " + className + " : " ).length(), "class " + className + " : public RuntimeBase::" + className + ", " );
-				}
-			}
-			
-			// process the new code
-			instance()->mInterpreter->enableRawInput();
-			instance()->mInterpreter->declare( code );
-			instance()->mInterpreter->enableRawInput( false );
-
-			// update instances with the new implementation
-			for( auto instance : instance()->mInstances ) {
-				auto instanceName = instance.first->getName();
-#ifdef RUNTIME_PTR_CEREALIZATION
-				bool cerealized = false;
-				std::stringstream archiveStream;
-#endif
-
-				// if the instance already exists override it
-				std::string scopedClassName = "RuntimeBase::" + className;
-				std::string scopedRuntimeClassName = uniqueNamespace + "::" + className;
-				if( getInterpreter()->getAddressOfGlobal( instanceName ) ) {
-#ifdef RUNTIME_PTR_CEREALIZATION
-					cereal::BinaryOutputArchive outputArchive( archiveStream );
-					instance.first->mCerealizer.save( instance.first->get(), outputArchive );
-					cerealized = true;
-#endif
-					getInterpreter()->process( instanceName + " = std::make_shared<" + scopedRuntimeClassName + ">();" );
-				}
-				// otherwise create it
-				else {
-					getInterpreter()->process( "std::shared_ptr<" + scopedClassName + "> " + instanceName + " = std::make_shared<" + scopedRuntimeClassName + ">();" );
-				}
-				
-				// grab the new address and update the runtime_ptr instance
-				if( auto address = getInterpreter()->getAddressOfGlobal( instanceName ) ) {
-					std::shared_ptr<T> base = *reinterpret_cast<std::shared_ptr<T>*>( address );
-					instance.second( *reinterpret_cast<std::shared_ptr<T>*>( address ) );
-#ifdef RUNTIME_PTR_CEREALIZATION
-					if( cerealized ) {
-						cereal::BinaryInputArchive inputArchive( archiveStream );
-						instance.first->mCerealizer.load( instance.first->get(), inputArchive );
-					}
-#endif
-				}
-			}
-		} );
+		if( options.getWarmUp() == WarmUp::IMMEDIATE ) {
+			initLock.unlock();
+			warmUp();
+		}
 	}
 	
-	return instance()->mInterpreter;
+	return isWarm() ? instance()->mInterpreter : nullptr;
 }
 
 template<class T>
-void runtime_class<T>::addIncludePath( const ci::fs::path &path )
-{
-	getInterpreter()->AddIncludePath( path.string() );
-}
-template<class T>
-void runtime_class<T>::loadFile( const ci::fs::path &path )
+void runtime_class<T>::warmUp()
 {
-	getInterpreter()->loadFile( path.string() );
+	std::lock_guard<std::mutex> warmUpLock( instance()->mWarmUpMutex );
+	if( instance()->mWarm ) {
+		return;
+	}
+	
+	// grab a cling interpreter from the pool, classes compiled with the same flags share the same interpreter
+	const Options &options = instance()->mOptions;
+	std::string className = ci::System::demangleTypeName( typeid( T ).name() );
+	auto args = runtime::getCompilerArgs( options.getStandard(), options.getOptimizationLevel(), options.getCompilerFlags() );
+	auto includePaths = options.getIncludePaths();
+	if( options.needsCinder() && ( ! options.getPrecompiledHeaders().empty() || options.isObjectCacheEnabled() ) ) {
+		args.push_back( "-DGLM_COMPILER=0" );
+		includePaths.push_back( runtime::getCinderIncludePath() );
+	}
+	auto libraryArgs = args;
+	
+	// parse the headers common to all generations once and for all
+	if( ! options.getPrecompiledHeaders().empty() ) {
+		auto pchPath = runtime::getPrecompiledHeader( options.getPrecompiledHeaders(), args, includePaths );
+		if( ! pchPath.empty() ) {
+			args.push_back( "-include-pch" );
+			args.push_back( pchPath.string() );
+		}
+	}
+	instance()->mSharedInterpreter = runtime::InterpreterPool::get().acquire( args, options.isInterpreterShared() ? std::string() : className );
+	instance()->mInterpreter = instance()->mSharedInterpreter->getInterpreter();
+	
+	// other classes might be compiling with the same interpreter
+	std::lock_guard<std::recursive_mutex> lock( getInterpreterMutex() );
+	instance()->mInterpreter->setDefaultOptLevel( options.getOptimizationLevel() );
+	
+	// add the parent path to the include paths
+	addIncludePath( instance()->mPath.parent_path() );
+	
+	// process the class options
+	for( const auto &p : options.getIncludePaths() ) {
+		addIncludePath( p );
+	}
+	for( const auto &p : options.getDynamicLibraries() ) {
+		loadFile( p );
+	}
+	for( const auto &d : options.getDeclarations() ) {
+		declare( d );
+	}
+	if( options.needsCinder() ) {
+		loadCinder();
+	}
+	
+	// wrap original code in its own namespace
+	std::string originalCode = instance()->mBaseIncludes + "\n\nnamespace RuntimeBase {\n" + instance()->mBaseCode + "\n};";
+	
+	// a previous run of the app might have already compiled the implementation, in which case only the content of the header is parsed
+	ci::fs::path libraryPath;
+	bool cacheable = options.isObjectCacheEnabled() && ! instance()->mBaseDeclarations.empty();
+	includePaths.push_back( instance()->mPath.parent_path() );
+	if( cacheable ) {
+		libraryPath = runtime::ObjectCache::get().find( originalCode, libraryArgs, includePaths, cling::Interpreter::getVersion() );
+	}
+	
+	// process the original code once, the next save has to be compiled if it fails
+	runtime::SharedInterpreter::ScopedMemoryMeasure measure( instance()->mSharedInterpreter.get() );
+	if( ! libraryPath.empty() ) {
+		loadFile( libraryPath );
+		originalCode = instance()->mBaseIncludes + "\n\nnamespace RuntimeBase {\n" + instance()->mBaseDeclarations + "\n};";
+	}
+	instance()->mInterpreter->enableRawInput();
+	if( instance()->mInterpreter->declare( originalCode ) != cling::Interpreter::kSuccess ) {
+		instance()->mSourceHash = 0;
+	}
+	instance()->mInterpreter->enableRawInput( false );
+	instance()->mInterpreter->declare( "#include <memory>" );
+	instance()->mBaseLayout = runtime::getClassLayout( instance()->mInterpreter.get(), "RuntimeBase::" + className );
+	if( options.isStateMigrationEnabled() ) {
+		declare( runtime::ClassLayout::getMigrationHelpers() );
+	}
+	
+	// otherwise build the library for the next run once the compile thread is free
+	if( cacheable && libraryPath.empty() ) {
+		runtime::CompileWorker::get().enqueue( [originalCode,libraryArgs,includePaths]() {
+			runtime::ObjectCache::get().build( originalCode, libraryArgs, includePaths, cling::Interpreter::getVersion() );
+		} );
+	}
+	
+	instance()->mWarm = true;
 }
+
 template<class T>
-void runtime_class<T>::loadCinder()
+void runtime_class<T>::watchSources( const ci::fs::path &absolutePath, const std::string &className, bool isCpp, const std::vector<std::string> &includes )
 {
-	auto blockPath = ci::fs::path( __FILE__ ).parent_path().parent_path();
-	getInterpreter()->declare( "#define GLM_COMPILER 0" );
-	getInterpreter()->AddIncludePath( blockPath.parent_path().parent_path().string() + "/include/" );
-#if defined(NDEBUG) || defined(_NDEBUG) || defined(RELEASE) || defined(MASTER) || defined(GOLD)
-	getInterpreter()->loadFile( blockPath.parent_path().parent_path().string() + "/lib/libcinder.dylib" );
-#else
-	getInterpreter()->loadFile( blockPath.parent_path().parent_path().string() + "/lib/libcinder_d.dylib" );
-#endif
+	std::vector<ci::fs::path> sources = { absolutePath };
+	if( isCpp ) {
+		sources.push_back( absolutePath.parent_path() / ( absolutePath.stem().string() + ".h" ) );
+	}
+	
+	// the new code is compiled on the compile thread once the burst of events editors usually generate when saving
+	// a file is over. Every class depending on a header that changed adds itself to a single transaction
+	double coalescingWindow = instance()->mOptions.getCoalescingWindow();
+	std::string group = instance()->mOptions.getReloadGroup();
+	runtime::IncludeGraph::get().update( className, sources, includes, instance()->mOptions.getIncludePaths(), [absolutePath,className,isCpp,coalescingWindow,group]( bool headerChanged ) {
+		if( headerChanged ) {
+			runtime::ReloadTransactions::get().queue( "headers", { className }, coalescingWindow );
+			return;
+		}
+		// the classes of a group share a single transaction, which compiles the ones that changed
+		if( ! group.empty() ) {
+			runtime::ReloadTransactions::get().queue( "group:" + group, { className }, coalescingWindow );
+			return;
+		}
+		runtime::CompileWorker::get().enqueue( absolutePath.string(), coalescingWindow, [absolutePath,className,isCpp]() {
+			compileGeneration( absolutePath, className, isCpp, false );
+		} );
+	} );
 }
+
 template<class T>
-void runtime_class<T>::declare( const std::string &declaration )
+void runtime_class<T>::addToReloadTransactions( const std::string &className )
 {
-	getInterpreter()->declare( declaration );
+	// swaps need both the instances and the interpreter
+	struct SwapLock {
+		std::unique_lock<std::mutex>			mSwap;
+		std::unique_lock<std::recursive_mutex>	mInterpreter;
+	};
+	
+	ci::fs::path absolutePath = instance()->mPath;
+	bool isCpp = absolutePath.extension() == ".cpp";
+	runtime::ReloadTransactions::Member member;
+	member.mName = className;
+	member.mCompile = [absolutePath,className,isCpp]( bool optimized ) {
+		return optimized ? compileOptimizedTier( true ) : compileGeneration( absolutePath, className, isCpp, true );
+	};
+	member.mFinish = []( bool commit ) {
+		// only classes that compiled are finished, which warmed their interpreter up
+		if( ! isWarm() ) {
+			return;
+		}
+		std::lock_guard<std::recursive_mutex> lock( getInterpreterMutex() );
+		if( commit ) {
+			discardGeneration( instance()->mCommitted );
+			instance()->mCommitted = instance()->mPrepared;
+			instance()->mSourceHash = instance()->mCommitted.mSourceHash;
+		}
+		else {
+			discardGeneration( instance()->mPrepared );
+		}
+		instance()->mPrepared = Generation();
+	};
+	member.mLock = []() -> std::shared_ptr<void> {
+		if( ! isWarm() ) {
+			return std::make_shared<SwapLock>();
+		}
+		auto lock = std::make_shared<SwapLock>();
+		lock->mSwap = std::unique_lock<std::mutex>( instance()->mSwapMutex, std::try_to_lock );
+		if( ! lock->mSwap.owns_lock() ) {
+			return nullptr;
+		}
+		lock->mInterpreter = std::unique_lock<std::recursive_mutex>( getInterpreterMutex(), std::try_to_lock );
+		if( ! lock->mInterpreter.owns_lock() ) {
+			return nullptr;
+		}
+		return lock;
+	};
+	member.mSwap = []() {
+		if( ! isWarm() ) {
+			return false;
+		}
+		// the instances of a transaction are all swapped in this frame, regardless of the swap budget
+		bool swapped = false;
+		if( instance()->mSwap.mInProgress ) {
+			continueSwap( 0.0 );
+			swapped = true;
+		}
+		// a committed generation replaced since by a newer version of the class is dropped
+		Generation committed = instance()->mCommitted;
+		instance()->mCommitted = Generation();
+		if( committed.mSourceHash == instance()->mSourceHash ) {
+			publishGeneration( committed );
+		}
+		else {
+			discardGeneration( committed );
+		}
+		if( startSwap() ) {
+			continueSwap( 0.0 );
+			swapped = true;
+		}
+		return swapped;
+	};
+	member.mSwapped = []() {
+		instance()->mSignalSwapped.emit();
+	};
+	runtime::ReloadTransactions::get().add( instance()->mOptions.getReloadGroup(), member );
 }
 
 template<class T>
-std::shared_ptr<cling::Interpreter> runtime_class<T>::getInterpreter()
+runtime::ReloadTransactions::CompileResult runtime_class<T>::compileGeneration( const ci::fs::path &absolutePath, const std::string &className, bool isCpp, bool transaction )
 {
-	if( !instance()->mInterpreter ) {
-		// try to find both header and cpp file
-		auto className	= ci::System::demangleTypeName( typeid(T).name() );
-		auto cpp		= className + ".cpp";
-		auto header		= className + ".h";
-		auto cppPath	= findFilePath( cpp );
-		auto headerPath = findFilePath( header );
-		// try to initialize it with a .cpp file equal to the class name
-		if( ! cppPath.empty() ) {
-			initialize( cpp, Options().cinder() );
-		}
-		// otherwise try to find a header
-		else if( ! headerPath.empty() ) {
-			initialize( header, Options().cinder() );
+	typedef runtime::ReloadTransactions::CompileResult CompileResult;
+	
+	// split the includes from the code
+	auto source = runtime::SourceAssembler::get().assembleClass( absolutePath );
+	const std::string &includesString = source.mIncludesString;
+	std::string code = source.mCode;
+	
+	// the interpreter already parsed the project headers included by the class, the ones that changed since are
+	// inlined in the generation namespace so the new code sees their new version. The types of a header would be
+	// distinct from the ones the rest of the app uses, so headers declaring types keep their original version. The graph
+	// and its hashes are kept up to date by the watcher, which only reads the files that changed again
+	std::string headersCode;
+	std::vector<runtime::Diagnostic> headersDiagnostics;
+	for( const auto &header : runtime::IncludeGraph::get().getDependencies( className ) ) {
+		if( runtime::IncludeGraph::get().hasChanged( header ) ) {
+			std::string headerCode = runtime::IncludeGraph::getInlinableCode( header );
+			if( runtime::IncludeGraph::declaresTypes( headerCode ) ) {
+				std::string message = header.filename().string() + " declares types and can't be reloaded, " + className + " uses its original version until the app restarts";
+				CI_LOG_W( message );
+				headersDiagnostics.push_back( { runtime::Diagnostic::Level::WARNING, message, header.string(), 0, 0 } );
+				continue;
+			}
+			headersCode += headerCode;
 		}
-		// can't find a .h or a .cpp, throw an exception
-		else {
-			throw MissingInterpreterException( ci::System::demangleTypeName( typeid(T).name() ) );
+	}
+	code = headersCode + code;
+	
+	// skip the reload if the file was saved without any actual change
+	uint64_t sourceHash = runtime::hash( includesString + code );
+	if( sourceHash == instance()->mSourceHash ) {
+		instance()->mNumSkippedReloads++;
+		return CompileResult::UNCHANGED;
+	}
+	
+	// the app is quitting, don't start a compilation that would delay it
+	if( runtime::CompileWorker::get().isStopping() ) {
+		return CompileResult::FAILED;
+	}
+	
+	// a lazily created interpreter is warmed up by the first actual change
+	warmUp();
+	
+	// with tiered compilation the new code is first compiled without optimizations to be swapped as soon as
+	// possible, then recompiled with the requested optimization level and swapped again
+	auto startTime = std::chrono::steady_clock::now();
+	bool tiered = instance()->mTieredCompilation && instance()->mOptimizationLevel > 0;
+	Generation generation;
+	bool compiled = declareGeneration( className, includesString, code, sourceHash, tiered ? 0 : instance()->mOptimizationLevel, false, startTime, generation );
+	if( ! headersDiagnostics.empty() ) {
+		std::lock_guard<std::mutex> pendingLock( instance()->mPendingMutex );
+		instance()->mDiagnostics.insert( instance()->mDiagnostics.begin(), headersDiagnostics.begin(), headersDiagnostics.end() );
+	}
+	instance()->mTierSource = TierSource();
+	if( compiled && tiered ) {
+		instance()->mTierSource.mClassName = className;
+		instance()->mTierSource.mIncludes = includesString;
+		instance()->mTierSource.mCode = code;
+		instance()->mTierSource.mSourceHash = sourceHash;
+		instance()->mTierSource.mStartTime = startTime;
+	}
+	
+	// the generation of a reload transaction waits for the other classes of the transaction, which then compiles their optimized tier
+	std::lock_guard<std::recursive_mutex> lock( getInterpreterMutex() );
+	if( transaction ) {
+		discardGeneration( instance()->mPrepared );
+		instance()->mPrepared = generation;
+	}
+	else {
+		publishGeneration( generation );
+		if( compiled && tiered ) {
+			runtime::CompileWorker::get().enqueue( absolutePath.string() + ":optimized", 0.0, []() {
+				compileOptimizedTier( false );
+			} );
 		}
 	}
-	return instance()->mInterpreter;
+	return compiled ? CompileResult::COMPILED : CompileResult::FAILED;
 }
 
 template<class T>
-void runtime_class<T>::registerInstance( runtime_ptr<T>* ptr )
+runtime::ReloadTransactions::CompileResult runtime_class<T>::compileOptimizedTier( bool transaction )
 {
-	instance()->mInstances[ptr] = [ptr]( const std::shared_ptr<T> &newInstance ) {
-		ptr->update( newInstance );
-	};
+	typedef runtime::ReloadTransactions::CompileResult CompileResult;
+	
+	// no need to optimize code that has already been replaced by a newer version or whose reload transaction got cancelled
+	TierSource source;
+	std::swap( source, instance()->mTierSource );
+	if( source.mCode.empty() || source.mSourceHash != instance()->mSourceHash || runtime::CompileWorker::get().isStopping() ) {
+		return CompileResult::UNCHANGED;
+	}
+	Generation optimized;
+	bool compiled = declareGeneration( source.mClassName, source.mIncludes, source.mCode, source.mSourceHash, instance()->mOptimizationLevel, true, source.mStartTime, optimized );
+	std::lock_guard<std::recursive_mutex> lock( getInterpreterMutex() );
+	if( transaction ) {
+		discardGeneration( instance()->mPrepared );
+		instance()->mPrepared = optimized;
+	}
+	else {
+		publishGeneration( optimized );
+	}
+	return compiled ? CompileResult::COMPILED : CompileResult::FAILED;
 }
+
 template<class T>
-void runtime_class<T>::unregisterInstance( runtime_ptr<T>* ptr )
+bool runtime_class<T>::declareGeneration( const std::string &className, const std::string &includesString, std::string code, uint64_t sourceHash, int optimizationLevel, bool optimizedTier, const std::chrono::steady_clock::time_point &startTime, Generation &generation )
 {
-	// make sure to release memory if the object exists in the interpreter
-	auto instanceName = ptr->getName();
-	if( getInterpreter()->getAddressOfGlobal( instanceName ) ) {
-		getInterpreter()->process( instanceName + ".reset();" );
+	// the main thread can't touch the interpreter while it's compiling
+	std::lock_guard<std::recursive_mutex> lock( getInterpreterMutex() );
+	
+	// make a unique namespace name
+	std::string uniqueNamespace;
+	instance()->mInterpreter->createUniqueName( uniqueNamespace );
+	uniqueNamespace = className + uniqueNamespace;
+	
+	// wrap the code in its own unique namespace
+	code = includesString + "\n\nnamespace " + uniqueNamespace + " {\n" + code + "\n};";
+	
+	// Make the class inherit from the original one
+	size_t pos = code.find( "class " + className + " { " );
+	if( pos != std::string::npos ) {
+		code.replace( pos, ( "class " + className + " { " ).length(), "class " + className + " : public RuntimeBase::" + className + " { " );
+	}
+	else {
+		pos = code.find( "class " + className + " : " );
+		if( pos != std::string::npos ) {
+			code.replace( pos, ( "class " + className + " : " ).length(), "class " + className + " : public RuntimeBase::" + className + ", " );
+		}
+	}
+	
+	// native entry points create the instances, declared in the same transaction to be unloaded with the generation
+	std::string factoryName = "runtimeCreate" + uniqueNamespace;
+	code += "\n\nextern \"C\" void " + factoryName + "( void *instances, size_t count ) {\n"
+		"\tauto ptrs = static_cast<std::shared_ptr<RuntimeBase::" + className + ">*>( instances );\n"
+		"\tfor( size_t i = 0; i < count; ++i ) {\n"
+		"\t\tptrs[i] = std::make_shared<" + uniqueNamespace + "::" + className + ">();\n"
+		"\t}\n"
+		"}\n"
+		"extern \"C\" void* " + factoryName + "Array( size_t count ) { return new " + uniqueNamespace + "::" + className + "[count]; }\n"
+		"extern \"C\" void " + factoryName + "ArrayDelete( void *instances ) { delete [] static_cast<" + uniqueNamespace + "::" + className + "*>( instances ); }\n"
+		"extern \"C\" void " + factoryName + "Destroy( void *instances, size_t count ) {\n"
+		"\ttypedef " + uniqueNamespace + "::" + className + " Type;\n"
+		"\tfor( size_t i = 0; i < count; ++i ) {\n"
+		"\t\tstatic_cast<Type*>( instances )[i].~Type();\n"
+		"\t}\n"
+		"\t::operator delete( instances );\n"
+		"}";
+	
+	// process the new code, keeping track of every transaction processed for the generation, lookups included, to be
+	// able to unload them later
+	auto sharedInterpreter = instance()->mSharedInterpreter;
+	const cling::Transaction *lastTransaction = instance()->mInterpreter->getLastTransaction();
+	cling::Interpreter::CompilationResult result;
+	std::vector<runtime::Diagnostic> diagnostics;
+	{
+		runtime::ScopedDiagnostics scopedDiagnostics( instance()->mInterpreter.get() );
+		runtime::SharedInterpreter::ScopedMemoryMeasure measure( instance()->mSharedInterpreter.get() );
+		instance()->mInterpreter->setDefaultOptLevel( optimizationLevel );
+		instance()->mInterpreter->enableRawInput();
+		result = instance()->mInterpreter->declare( code );
+		instance()->mInterpreter->enableRawInput( false );
+		instance()->mInterpreter->setDefaultOptLevel( instance()->mOptimizationLevel );
+		diagnostics = scopedDiagnostics.getDiagnostics();
+	}
+	
+	// the interpreter reverts the declarations of a failed transaction, nothing is published and the instances keep
+	// using the last generation that compiled
+	bool compiled = result == cling::Interpreter::kSuccess;
+	{
+		std::lock_guard<std::mutex> pendingLock( instance()->mPendingMutex );
+		instance()->mDiagnostics = diagnostics;
+		instance()->mCompileFailed = ! compiled;
+	}
+	if( ! compiled ) {
+		sharedInterpreter->release( sharedInterpreter->getTransactionsSince( lastTransaction ) );
+		instance()->mNumFailedCompilations++;
+		return false;
+	}
+	
+	// the layout tells whether the instances can be switched to the new generation in place
+	runtime::ClassLayout layout = runtime::getClassLayout( instance()->mInterpreter.get(), uniqueNamespace + "::" + className );
+	FactoryFn factory = reinterpret_cast<FactoryFn>( instance()->mInterpreter->getAddressOfGlobal( factoryName ) );
+	ArrayFactoryFn arrayFactory = reinterpret_cast<ArrayFactoryFn>( instance()->mInterpreter->getAddressOfGlobal( factoryName + "Array" ) );
+	ArrayDeleterFn arrayDeleter = reinterpret_cast<ArrayDeleterFn>( instance()->mInterpreter->getAddressOfGlobal( factoryName + "ArrayDelete" ) );
+	DestroyFn destroyer = reinterpret_cast<DestroyFn>( instance()->mInterpreter->getAddressOfGlobal( factoryName + "Destroy" ) );
+	std::vector<cling::Transaction*> transactions = sharedInterpreter->getTransactionsSince( lastTransaction );
+	lastTransaction = instance()->mInterpreter->getLastTransaction();
+	
+	// generate the code moving the members of the instances from any layout they might currently have
+	std::map<uint64_t,MigrationFn> migrations;
+	std::map<uint64_t,ConstructFn> constructors;
+	if( layout.isValid() && instance()->mOptions.isStateMigrationEnabled() ) {
+		std::vector<const runtime::ClassLayout*> sources = { &instance()->mBaseLayout };
+		for( const auto &source : instance()->mLayouts ) {
+			sources.push_back( &source.second );
+		}
+		for( auto source : sources ) {
+			uint64_t fingerprint = source->getFingerprint();
+			// instances with the same layout are switched in place unless another thread might be reading them
+			bool inPlace = instance()->mOptions.isInPlaceSwapEnabled() && ! runtime::Reclaimer::get().getNumThreads();
+			if( ! source->isValid() || ( *source == layout && inPlace ) || migrations.count( fingerprint ) ) {
+				continue;
+			}
+			std::stringstream name;
+			name << "runtimeMigrate" << uniqueNamespace << "_" << std::hex << fingerprint;
+			std::string migrationCode = runtime::ClassLayout::getMigrationCode( name.str(), *source, layout );
+			if( ! migrationCode.empty() && instance()->mInterpreter->declare( migrationCode ) == cling::Interpreter::kSuccess ) {
+				if( auto address = instance()->mInterpreter->getAddressOfGlobal( name.str() ) ) {
+					migrations[fingerprint] = reinterpret_cast<MigrationFn>( address );
+				}
+			}
+			// the constructor of the new instance doesn't need to run when every member can be taken from the previous one
+			std::string constructionCode = runtime::ClassLayout::getConstructionCode( name.str() + "Construct", *source, layout );
+			if( ! constructionCode.empty() && instance()->mInterpreter->declare( constructionCode ) == cling::Interpreter::kSuccess ) {
+				if( auto address = instance()->mInterpreter->getAddressOfGlobal( name.str() + "Construct" ) ) {
+					constructors[fingerprint] = reinterpret_cast<ConstructFn>( address );
+				}
+			}
+		}
 	}
-	instance()->mInstances.erase( ptr );
+	std::vector<cling::Transaction*> migrationTransactions = sharedInterpreter->getTransactionsSince( lastTransaction );
+	
+	generation.mNamespace = uniqueNamespace;
+	generation.mTransactions = transactions;
+	generation.mSourceHash = sourceHash;
+	generation.mFactory = factory;
+	generation.mArrayFactory = arrayFactory;
+	generation.mArrayDeleter = arrayDeleter;
+	generation.mDestroyer = destroyer;
+	generation.mLayout = layout;
+	generation.mVTables = runtime::getVTables( instance()->mInterpreter.get(), layout );
+	generation.mMigrations = migrations;
+	generation.mConstructors = constructors;
+	generation.mMigrationTransactions = migrationTransactions;
+	generation.mOptimizedTier = optimizedTier;
+	generation.mStartTime = startTime;
+	return compiled;
 }
 
 template<class T>
-runtime_ptr<T>::runtime_ptr( bool runtime )
-: mPtr( std::make_shared<T>() )
+void runtime_class<T>::publishGeneration( Generation &generation )
 {
-	runtime_class<T>::registerInstance( this );
+	if( generation.mNamespace.empty() ) {
+		return;
+	}
+	instance()->mSourceHash = generation.mSourceHash;
+	
+	// the instances will be swapped by the next applyPending, the previous pending generation never got applied
+	Generation previous;
+	{
+		std::lock_guard<std::mutex> pendingLock( instance()->mPendingMutex );
+		previous = instance()->mPending;
+		instance()->mPending = generation;
+	}
+	discardGeneration( previous );
 }
 
 template<class T>
-runtime_ptr<T>::runtime_ptr( const runtime_ptr& other )
-: mPtr( other.mPtr )
+void runtime_class<T>::discardGeneration( Generation &generation )
 {
-	runtime_class<T>::registerInstance( this );
+	if( generation.mNamespace.empty() ) {
+		return;
+	}
+	
+	// the generation never got applied and can be released right away, the interpreter holds the lock
+	instance()->mSharedInterpreter->release( generation.mMigrationTransactions );
+	instance()->mSharedInterpreter->release( generation.mTransactions );
+	instance()->mNumReleasedGenerations++;
 }
 
 template<class T>
-runtime_ptr<T>::runtime_ptr( runtime_ptr&& other )
-: mPtr( std::move( other.mPtr ) )
+void runtime_class<T>::applyPending()
 {
-	// TODO : Do we realy need to unregister in case of a move?
-	runtime_class<T>::unregisterInstance( &other );
-	runtime_class<T>::registerInstance( this );
+	// release the instances replaced by the previous swaps once the other threads are done with them
+	runtime::Reclaimer::get().collect();
+	
+	// nothing can be pending before the interpreter is warmed up
+	if( ! isWarm() ) {
+		return;
+	}
+	
+	// a swap completed by parallelForEach is reported on the main thread
+	if( instance()->mSignalSwappedPending.exchange( false ) ) {
+		instance()->mSignalSwapped.emit();
+	}
+	
+	// report the compilations that failed since the last frame
+	std::vector<runtime::Diagnostic> diagnostics;
+	bool failed;
+	{
+		std::lock_guard<std::mutex> pendingLock( instance()->mPendingMutex );
+		failed = instance()->mCompileFailed;
+		if( failed ) {
+			diagnostics = instance()->mDiagnostics;
+			instance()->mCompileFailed = false;
+		}
+	}
+	if( failed ) {
+		instance()->mSignalCompileFailed.emit( diagnostics );
+	}
+	
+	// the classes reloaded by a transaction are swapped together, the classes of a reload group are only reloaded that way
+	runtime::ReloadTransactions::get().apply();
+	if( ! instance()->mOptions.getReloadGroup().empty() ) {
+		return;
+	}
+	
+	// the compile thread might be busy with the interpreter or a parallelForEach with the instances, in which case we'll try again on the next frame
+	std::unique_lock<std::mutex> swapLock( instance()->mSwapMutex, std::try_to_lock );
+	if( ! swapLock.owns_lock() ) {
+		return;
+	}
+	std::unique_lock<std::recursive_mutex> lock( getInterpreterMutex(), std::try_to_lock );
+	if( ! lock.owns_lock() ) {
+		return;
+	}
+	
+	// start swapping the instances to the pending generation unless the previous one is still being applied
+	if( ! instance()->mSwap.mInProgress && ! startSwap() ) {
+		return;
+	}
+	
+	if( continueSwap( instance()->mOptions.getSwapBudget() ) ) {
+		instance()->mSignalSwapped.emit();
+	}
+}
+
+template<class T>
+bool runtime_class<T>::startSwap()
+{
+	Generation pending;
+	{
+		std::lock_guard<std::mutex> pendingLock( instance()->mPendingMutex );
+		std::swap( pending, instance()->mPending );
+	}
+	if( pending.mNamespace.empty() ) {
+		return false;
+	}
+	auto &swap = instance()->mSwap;
+	uint32_t index = swap.mIndex + 1;
+	swap = Swap();
+	swap.mInProgress = true;
+	swap.mIndex = index;
+	swap.mLoaded = { pending.mTransactions, nullptr, {} };
+	swap.mGeneration = std::move( pending );
+	return true;
+}
+
+template<class T>
+bool runtime_class<T>::continueSwap( double budget )
+{
+	std::lock_guard<std::recursive_mutex> listLock( instance()->mListMutex );
+	auto &swap = instance()->mSwap;
+	Generation &pending = swap.mGeneration;
+	const auto &layout = pending.mLayout;
+	
+	// instances are swapped until the budget of the frame is spent, the cost of the ones to recreate is estimated from the previous batches
+	auto frameStart = std::chrono::steady_clock::now();
+	double recreateCost = swap.mRecreateCost > 0.0 ? swap.mRecreateCost : budget / 16.0;
+	size_t numProcessed = 0, numRemaining = 0;
+	auto hasTime = [&]( size_t numRecreated ) {
+		// at least one instance or vector is swapped on each frame
+		return budget <= 0.0 || ! numProcessed || std::chrono::duration<double>( std::chrono::steady_clock::now() - frameStart ).count() + numRecreated * recreateCost < budget;
+	};
+	
+	// switch the instances that keep the same layout in place, picking the cheapest way to keep the state of the others. Rewriting the
+	// vtable pointers of an instance another thread is calling is a data race, so this only happens while every reader thread is offline
+	runtime::Reclaimer::ScopedExclusive exclusive;
+	std::vector<std::pair<runtime_ptr<T>*,Transfer>> recreated;
+	for( runtime_ptr<T> *ptr = instance()->mFirstInstance; ptr; ptr = ptr->mNextInstance ) {
+		// moved-from pointers don't have anything to swap
+		T *object = ptr->get();
+		if( ! object || ptr->mGeneration == swap.mIndex ) {
+			continue;
+		}
+		if( ! hasTime( recreated.size() ) ) {
+			numRemaining++;
+			continue;
+		}
+		auto transferStart = std::chrono::steady_clock::now();
+		Transfer transfer = selectTransfer( object, pending, exclusive.isAcquired() );
+		
+		// the original class is the primary base of the generations so the vtable pointers of the object can be switched directly
+		if( transfer == Transfer::IN_PLACE ) {
+			if( swap.mVTables.empty() ) {
+				swap.mVTables = pending.mVTables;
+				registerLayout( swap.mVTables.empty() ? nullptr : swap.mVTables.front(), layout );
+			}
+			if( swap.mVTables.size() == layout.mVTablePointers.size() ) {
+				char *bytes = reinterpret_cast<char*>( object );
+				for( size_t i = 0; i < swap.mVTables.size(); ++i ) {
+					*reinterpret_cast<void**>( bytes + layout.mVTablePointers[i] ) = swap.mVTables[i];
+				}
+				swap.mLoaded.mInstances.push_back( ptr->mPtr );
+				ptr->mGeneration = swap.mIndex;
+				numProcessed++;
+				swap.mNumTransfers[static_cast<size_t>( transfer )]++;
+				swap.mDurations[static_cast<size_t>( transfer )] += std::chrono::duration<double>( std::chrono::steady_clock::now() - transferStart ).count();
+				continue;
+			}
+			transfer = Transfer::RECREATE;
+		}
+		recreated.push_back( { ptr, transfer } );
+		numProcessed++;
+	}
+	
+	// instances whose members can all be copied are built from the previous ones without running their constructor,
+	// all the other ones are created with a single native call to the factory of the generation
+	auto recreateStart = std::chrono::steady_clock::now();
+	std::vector<std::shared_ptr<T>> newInstances( recreated.size() );
+	std::vector<bool> constructed( recreated.size(), false );
+	size_t numCreated = 0;
+	for( size_t i = 0; i < recreated.size(); ++i ) {
+		if( recreated[i].second == Transfer::FIELDS ) {
+			newInstances[i] = constructInstances( recreated[i].first->get(), 1, pending, isUnreachable( recreated[i].first->mPtr, exclusive.isAcquired() ) );
+			constructed[i] = newInstances[i] != nullptr;
+		}
+		numCreated += constructed[i] ? 0 : 1;
+	}
+	std::vector<std::shared_ptr<T>> createdInstances( pending.mFactory ? numCreated : 0 );
+	if( ! createdInstances.empty() ) {
+		pending.mFactory( createdInstances.data(), createdInstances.size() );
+	}
+	for( size_t i = 0, j = 0; i < recreated.size() && j < createdInstances.size(); ++i ) {
+		if( ! constructed[i] ) {
+			newInstances[i] = std::move( createdInstances[j++] );
+		}
+	}
+	if( std::is_polymorphic<T>::value && ! swap.mVTable ) {
+		for( const auto &newInstance : newInstances ) {
+			if( newInstance ) {
+				swap.mVTable = *reinterpret_cast<void**>( newInstance.get() );
+				registerLayout( swap.mVTable, layout );
+				break;
+			}
+		}
+	}
+	double factoryDuration = newInstances.empty() ? 0.0 : std::chrono::duration<double>( std::chrono::steady_clock::now() - recreateStart ).count() / newInstances.size();
+	
+	for( size_t i = 0; i < recreated.size(); ++i ) {
+		auto transferStart = std::chrono::steady_clock::now();
+		runtime_ptr<T> *ptr = recreated[i].first;
+		Transfer transfer = recreated[i].second;
+		T *object = ptr->get();
+		// an instance the generation couldn't build keeps its current generation
+		if( ! newInstances[i] ) {
+			continue;
+		}
+		const std::shared_ptr<T> &base = newInstances[i];
+		ptr->mGeneration = swap.mIndex;
+		
+		// the runtime_ptr still holds the previous instance at this point
+		if( ! constructed[i] ) {
+			transferState( transfer, object, base.get(), pending, isUnreachable( ptr->mPtr, exclusive.isAcquired() ) );
+		}
+		swap.mLoaded.mInstances.push_back( base );
+		ptr->update( base );
+		
+		swap.mNumTransfers[static_cast<size_t>( transfer )]++;
+		swap.mDurations[static_cast<size_t>( transfer )] += factoryDuration + std::chrono::duration<double>( std::chrono::steady_clock::now() - transferStart ).count();
+	}
+	if( ! recreated.empty() ) {
+		swap.mRecreateCost = std::chrono::duration<double>( std::chrono::steady_clock::now() - recreateStart ).count() / recreated.size();
+	}
+	
+	// vectors are swapped as a whole
+	for( runtime_vector<T> *vector = instance()->mFirstVector; vector; vector = vector->mNextVector ) {
+		if( vector->empty() || vector->mGeneration == swap.mIndex ) {
+			continue;
+		}
+		if( ! hasTime( vector->size() ) ) {
+			numRemaining += vector->size();
+			continue;
+		}
+		auto transferStart = std::chrono::steady_clock::now();
+		size_t count = vector->size();
+		Transfer transfer;
+		if( ! swapVector( vector, pending, swap.mVTables, swap.mVTable, swap.mLoaded, exclusive.isAcquired(), transfer ) ) {
+			CI_LOG_W( "The instances of a runtime_vector<" << ci::System::demangleTypeName( typeid( T ).name() ) << "> can't be built by " << pending.mNamespace << ", they keep their current generation" );
+			continue;
+		}
+		vector->mGeneration = swap.mIndex;
+		swap.mNumTransfers[static_cast<size_t>( transfer )] += count;
+		swap.mDurations[static_cast<size_t>( transfer )] += std::chrono::duration<double>( std::chrono::steady_clock::now() - transferStart ).count();
+		numProcessed += count;
+	}
+	swap.mNumSwapped += numProcessed;
+	swap.mNumRemaining = numRemaining;
+	if( numRemaining ) {
+		return false;
+	}
+	
+	// log which paths were taken and how long they took
+	std::string className = ci::System::demangleTypeName( typeid( T ).name() );
+	std::stringstream summary;
+	for( size_t i = 0; i < sNumTransfers; ++i ) {
+		instance()->mNumTransfers[i] += swap.mNumTransfers[i];
+		if( swap.mNumTransfers[i] ) {
+			summary << " " << swap.mNumTransfers[i] << " " << getTransferName( static_cast<Transfer>( i ) ) << " in " << swap.mDurations[i] * 1000.0 << "ms";
+		}
+	}
+	if( ! summary.str().empty() ) {
+		CI_LOG_I( className << " swapped to " << pending.mNamespace << ":" << summary.str() );
+	}
+	instance()->mLayout = layout;
+	swap.mLoaded.mVTable = swap.mVTables.empty() ? swap.mVTable : swap.mVTables.front();
+	
+	// the migration code isn't needed anymore, it is unloaded right away unless newer code was processed since
+	instance()->mSharedInterpreter->release( pending.mMigrationTransactions );
+	
+	// measure the time between the start of the compilation and the swap
+	double latency = std::chrono::duration<double>( std::chrono::steady_clock::now() - pending.mStartTime ).count();
+	if( pending.mOptimizedTier ) {
+		instance()->mOptimizedTierLatency = latency;
+	}
+	else {
+		instance()->mFastTierLatency = latency;
+	}
+	
+	// release the generations that aren't used anymore on the compile thread
+	bool unload;
+	{
+		std::lock_guard<std::mutex> pendingLock( instance()->mPendingMutex );
+		instance()->mGenerations.push_back( swap.mLoaded );
+		unload = instance()->mGenerations.size() > instance()->mOptions.getMaxOldGenerations() + 1;
+	}
+	if( unload ) {
+		runtime::CompileWorker::get().enqueue( [](){ unloadGenerations(); } );
+	}
+	
+	swap.mInProgress = false;
+	swap.mGeneration = Generation();
+	swap.mLoaded = LoadedGeneration();
+	return true;
+}
+
+template<class T>
+double runtime_class<T>::getSwapProgress()
+{
+	const auto &swap = instance()->mSwap;
+	if( ! swap.mInProgress || ! ( swap.mNumSwapped + swap.mNumRemaining ) ) {
+		return swap.mInProgress ? 0.0 : 1.0;
+	}
+	return static_cast<double>( swap.mNumSwapped ) / static_cast<double>( swap.mNumSwapped + swap.mNumRemaining );
+}
+
+template<class T>
+void runtime_class<T>::transferState( Transfer transfer, T *from, T *to, Generation &generation, bool move )
+{
+#ifdef RUNTIME_PTR_CEREALIZATION
+	// the state of the previous instance, either created natively or by a previous generation, goes through an archive
+	if( transfer == Transfer::CEREAL ) {
+		typename runtime_ptr<T>::template Cerealizer<T> cerealizer;
+		std::stringstream archiveStream;
+		{
+			cereal::BinaryOutputArchive outputArchive( archiveStream );
+			cerealizer.save( from, outputArchive );
+		}
+		cereal::BinaryInputArchive inputArchive( archiveStream );
+		cerealizer.load( to, inputArchive );
+	}
+#endif
+	if( transfer == Transfer::MEMCPY || transfer == Transfer::FIELDS ) {
+		const auto &fromLayout = *findLayout( from );
+		runtime::ClassLayout::copyTrivialFields( fromLayout, from, generation.mLayout, to );
+		auto migration = generation.mMigrations.find( fromLayout.getFingerprint() );
+		if( transfer == Transfer::FIELDS && migration != generation.mMigrations.end() ) {
+			migration->second( from, to, move );
+		}
+	}
+}
+
+template<class T>
+std::shared_ptr<T> runtime_class<T>::constructInstances( T *from, size_t count, const Generation &generation, bool move )
+{
+	// the instances are built in raw memory from every member of the previous ones, their constructor isn't called
+	const auto &layout = generation.mLayout;
+	const runtime::ClassLayout *fromLayout = findLayout( from );
+	auto constructor = fromLayout ? generation.mConstructors.find( fromLayout->getFingerprint() ) : generation.mConstructors.end();
+	if( constructor == generation.mConstructors.end() || ! generation.mDestroyer || generation.mVTables.empty() || generation.mVTables.size() != layout.mVTablePointers.size() ) {
+		return nullptr;
+	}
+	auto destroyer = generation.mDestroyer;
+	size_t fromStride = fromLayout->mSize;
+	char *data = static_cast<char*>( ::operator new( layout.mSize * count ) );
+	for( size_t i = 0; i < count; ++i ) {
+		// the first instance already fails if one of the members can't be copied
+		char *bytes = data + i * layout.mSize;
+		if( ! constructor->second( reinterpret_cast<char*>( from ) + i * fromStride, bytes, move ) ) {
+			if( i ) {
+				destroyer( data, i );
+			}
+			else {
+				::operator delete( data );
+			}
+			return nullptr;
+		}
+		for( size_t j = 0; j < generation.mVTables.size(); ++j ) {
+			*reinterpret_cast<void**>( bytes + layout.mVTablePointers[j] ) = generation.mVTables[j];
+		}
+	}
+	return std::shared_ptr<T>( reinterpret_cast<T*>( data ), [destroyer,count]( T *instances ) { destroyer( instances, count ); } );
+}
+
+template<class T>
+bool runtime_class<T>::swapVector( runtime_vector<T>* vector, Generation &generation, std::vector<void*> &vtables, void *&vtable, LoadedGeneration &loadedGeneration, bool exclusive, Transfer &transfer )
+{
+	// all the instances of a vector share the same generation
+	const auto &layout = generation.mLayout;
+	T *first = vector->mData;
+	transfer = selectTransfer( first, generation, exclusive );
+	
+	// switch the vtable pointers of every instance of the block
+	if( transfer == Transfer::IN_PLACE ) {
+		if( vtables.empty() ) {
+			vtables = generation.mVTables;
+			registerLayout( vtables.empty() ? nullptr : vtables.front(), layout );
+		}
+		if( vtables.size() == layout.mVTablePointers.size() ) {
+			for( size_t i = 0; i < vector->size(); ++i ) {
+				char *bytes = reinterpret_cast<char*>( &(*vector)[i] );
+				for( size_t j = 0; j < vtables.size(); ++j ) {
+					*reinterpret_cast<void**>( bytes + layout.mVTablePointers[j] ) = vtables[j];
+				}
+			}
+			// the block now relies on the code of the generation
+			loadedGeneration.mInstances.push_back( vector->mBlock );
+			return true;
+		}
+		transfer = Transfer::RECREATE;
+	}
+	
+	// otherwise build a new block from the previous one without running the constructors if every member can be copied,
+	// or allocate it with a single call and copy the state of each instance to it
+	if( ! layout.isValid() ) {
+		return false;
+	}
+	bool move = isUnreachable( vector->mBlock, exclusive );
+	std::shared_ptr<T> block = transfer == Transfer::FIELDS ? constructInstances( first, vector->size(), generation, move ) : nullptr;
+	bool constructed = block != nullptr;
+	if( ! constructed ) {
+		char *instances = generation.mArrayFactory && generation.mArrayDeleter ? static_cast<char*>( generation.mArrayFactory( vector->size() ) ) : nullptr;
+		if( ! instances ) {
+			return false;
+		}
+		auto deleter = generation.mArrayDeleter;
+		block = std::shared_ptr<T>( reinterpret_cast<T*>( instances ), [deleter]( T *instances ) { deleter( instances ); } );
+	}
+	char *data = reinterpret_cast<char*>( block.get() );
+	if( std::is_polymorphic<T>::value && ! vtable ) {
+		vtable = *reinterpret_cast<void**>( data );
+		registerLayout( vtable, layout );
+	}
+	for( size_t i = 0; i < vector->size() && ! constructed; ++i ) {
+		transferState( transfer, &(*vector)[i], reinterpret_cast<T*>( data + i * layout.mSize ), generation, move );
+	}
+	
+	// other threads might still be iterating over the previous block
+	runtime::Reclaimer::get().retire( std::move( vector->mBlock ) );
+	vector->mBlock = block;
+	vector->mData = block.get();
+	vector->mStride = layout.mSize;
+	loadedGeneration.mInstances.push_back( block );
+	return true;
+}
+
+template<class T>
+void runtime_class<T>::registerLayout( void *vtable, const runtime::ClassLayout &layout )
+{
+	if( vtable ) {
+		instance()->mLayouts[vtable] = layout;
+	}
+}
+
+template<class T>
+const runtime::ClassLayout* runtime_class<T>::findLayout( const T *object )
+{
+	// objects are told apart by their vtable, anything that isn't a known generation was created natively
+	if( ! std::is_polymorphic<T>::value ) {
+		return nullptr;
+	}
+	auto it = instance()->mLayouts.find( *reinterpret_cast<void* const*>( object ) );
+	if( it != instance()->mLayouts.end() ) {
+		return &it->second;
+	}
+	return instance()->mBaseLayout.isValid() ? &instance()->mBaseLayout : nullptr;
+}
+
+template<class T>
+typename runtime_class<T>::Transfer runtime_class<T>::selectTransfer( const T *object, const Generation &generation, bool inPlace )
+{
+	const runtime::ClassLayout &layout = generation.mLayout;
+	if( ! object ) {
+		return Transfer::RECREATE;
+	}
+	
+	const runtime::ClassLayout *objectLayout = findLayout( object );
+	if( objectLayout && layout.isValid() && *objectLayout == layout && inPlace && instance()->mOptions.isInPlaceSwapEnabled() ) {
+		return Transfer::IN_PLACE;
+	}
+#ifdef RUNTIME_PTR_CEREALIZATION
+	// classes that know how to save their state always do it themselves
+	if( runtime_ptr<T>::template Cerealizer<T>::isSupported() ) {
+		return Transfer::CEREAL;
+	}
+#endif
+	if( objectLayout && layout.isValid() ) {
+		if( generation.mMigrations.count( objectLayout->getFingerprint() ) || generation.mConstructors.count( objectLayout->getFingerprint() ) ) {
+			return Transfer::FIELDS;
+		}
+		for( const auto &match : runtime::ClassLayout::matchFields( *objectLayout, layout ) ) {
+			if( runtime::ClassLayout::isMemcpyable( layout.mFields[match.second] ) ) {
+				return Transfer::MEMCPY;
+			}
+		}
+	}
+	return Transfer::RECREATE;
+}
+
+template<class T>
+const char* runtime_class<T>::getTransferName( Transfer transfer )
+{
+	switch( transfer ) {
+		case Transfer::IN_PLACE: return "in place";
+		case Transfer::MEMCPY: return "memcpy";
+		case Transfer::FIELDS: return "fields";
+		case Transfer::CEREAL: return "cereal";
+		case Transfer::RECREATE: return "recreate";
+	}
+	return "";
+}
+
+template<class T>
+void runtime_class<T>::unloadGenerations()
+{
+	std::lock_guard<std::recursive_mutex> lock( getInterpreterMutex() );
+	
+	std::vector<std::vector<cling::Transaction*>> transactions;
+	{
+		std::lock_guard<std::mutex> pendingLock( instance()->mPendingMutex );
+		auto &generations = instance()->mGenerations;
+		size_t maxOldGenerations = instance()->mOptions.getMaxOldGenerations();
+		
+		// the newest generation is the one used by the instances, the oldest unused ones go first
+		for( size_t i = 0; i + 1 < generations.size() && generations.size() > maxOldGenerations + 1; ) {
+			bool used = false;
+			for( const auto &weakInstance : generations[i].mInstances ) {
+				if( ! weakInstance.expired() ) {
+					used = true;
+					break;
+				}
+			}
+			if( used ) {
+				++i;
+			}
+			else {
+				transactions.push_back( generations[i].mTransactions );
+				instance()->mLayouts.erase( generations[i].mVTable );
+				generations.erase( generations.begin() + i );
+			}
+		}
+	}
+	
+	for( const auto &generationTransactions : transactions ) {
+		instance()->mSharedInterpreter->release( generationTransactions );
+		instance()->mNumReleasedGenerations++;
+	}
+}
+
+template<class T>
+size_t runtime_class<T>::getNumGenerations()
+{
+	std::lock_guard<std::mutex> pendingLock( instance()->mPendingMutex );
+	return instance()->mGenerations.size() + ( instance()->mPending.mNamespace.empty() ? 0 : 1 ) + ( instance()->mSwap.mInProgress ? 1 : 0 );
+}
+
+template<class T>
+std::vector<runtime::Diagnostic> runtime_class<T>::getDiagnostics()
+{
+	std::lock_guard<std::mutex> pendingLock( instance()->mPendingMutex );
+	return instance()->mDiagnostics;
+}
+
+template<class T>
+bool runtime_class<T>::hasPending()
+{
+	std::lock_guard<std::mutex> pendingLock( instance()->mPendingMutex );
+	return ! instance()->mPending.mNamespace.empty();
+}
+
+template<class T>
+void runtime_class<T>::parallelForEach( const std::function<void(T&)> &fn, size_t grainSize )
+{
+	std::lock_guard<std::mutex> swapLock( instance()->mSwapMutex );
+	
+	// a swap spread over several frames is completed first so the batch doesn't mix two generations. Waiting for the compile
+	// thread to release the interpreter could stall the caller for a whole compilation, the swap then goes on in applyPending
+	if( instance()->mSwap.mInProgress ) {
+		std::unique_lock<std::recursive_mutex> lock( getInterpreterMutex(), std::try_to_lock );
+		if( lock.owns_lock() && continueSwap( 0.0 ) ) {
+			instance()->mSignalSwappedPending = true;
+		}
+	}
+	
+	// the lists are only locked while collecting the objects so fn can create or destroy runtime_ptrs
+	std::vector<T*> objects;
+	{
+		std::lock_guard<std::recursive_mutex> listLock( instance()->mListMutex );
+		for( runtime_ptr<T> *ptr = instance()->mFirstInstance; ptr; ptr = ptr->mNextInstance ) {
+			if( T *object = ptr->get() ) {
+				objects.push_back( object );
+			}
+		}
+		for( runtime_vector<T> *vector = instance()->mFirstVector; vector; vector = vector->mNextVector ) {
+			for( size_t i = 0; i < vector->size(); ++i ) {
+				objects.push_back( &(*vector)[i] );
+			}
+		}
+	}
+	
+	runtime::TaskPool::get().parallelFor( objects.size(), grainSize, [&objects,&fn]( size_t begin, size_t end ) {
+		for( size_t i = begin; i < end; ++i ) {
+			fn( *objects[i] );
+		}
+	} );
+}
+
+template<class T>
+void runtime_class<T>::addIncludePath( const ci::fs::path &path )
+{
+	instance()->mSharedInterpreter->addIncludePath( path );
+}
+template<class T>
+void runtime_class<T>::loadFile( const ci::fs::path &path )
+{
+	instance()->mSharedInterpreter->loadFile( path );
+}
+template<class T>
+void runtime_class<T>::loadCinder()
+{
+	instance()->mSharedInterpreter->loadCinder();
+}
+template<class T>
+void runtime_class<T>::declare( const std::string &declaration )
+{
+	instance()->mSharedInterpreter->declare( declaration );
+}
+
+template<class T>
+ci::fs::path runtime_class<T>::findSourcePath()
+{
+	// try to find both header and cpp file
+	auto className	= ci::System::demangleTypeName( typeid(T).name() );
+	auto cpp		= className + ".cpp";
+	auto header		= className + ".h";
+	// try with a .cpp file equal to the class name
+	if( ! findFilePath( cpp ).empty() ) {
+		return cpp;
+	}
+	// otherwise try to find a header
+	else if( ! findFilePath( header ).empty() ) {
+		return header;
+	}
+	return ci::fs::path();
+}
+
+template<class T>
+void runtime_class<T>::connectUpdate()
+{
+	if( ! instance()->mUpdateConnection.isConnected() ) {
+		if( auto app = ci::app::AppBase::get() ) {
+			instance()->mUpdateConnection = app->getSignalUpdate().connect( [](){ applyPending(); } );
+		}
+	}
+}
+
+template<class T>
+std::shared_ptr<cling::Interpreter> runtime_class<T>::getInterpreter()
+{
+	autoInitialize();
+	warmUp();
+	return instance()->mInterpreter;
+}
+
+template<class T>
+void runtime_class<T>::autoInitialize()
+{
+	// classes that haven't been initialized look for their source, with the default options
+	if( ! instance()->mInitialized ) {
+		auto path = findSourcePath();
+		// can't find a .h or a .cpp, throw an exception
+		if( path.empty() ) {
+			throw MissingInterpreterException( ci::System::demangleTypeName( typeid(T).name() ) );
+		}
+		initialize( path, Options().cinder() );
+	}
+}
+
+template<class T>
+void runtime_class<T>::registerInstance( runtime_ptr<T>* ptr )
+{
+	autoInitialize();
+	std::lock_guard<std::recursive_mutex> listLock( instance()->mListMutex );
+	if( isRegistered( ptr ) ) {
+		return;
+	}
+	ptr->mPrevInstance = nullptr;
+	ptr->mNextInstance = instance()->mFirstInstance;
+	if( instance()->mFirstInstance ) {
+		instance()->mFirstInstance->mPrevInstance = ptr;
+	}
+	instance()->mFirstInstance = ptr;
+}
+template<class T>
+void runtime_class<T>::unregisterInstance( runtime_ptr<T>* ptr )
+{
+	// the instances are only owned by their runtime_ptr, nothing has to be released in the interpreter
+	std::lock_guard<std::recursive_mutex> listLock( instance()->mListMutex );
+	if( ! isRegistered( ptr ) ) {
+		return;
+	}
+	if( ptr->mPrevInstance ) {
+		ptr->mPrevInstance->mNextInstance = ptr->mNextInstance;
+	}
+	else {
+		instance()->mFirstInstance = ptr->mNextInstance;
+	}
+	if( ptr->mNextInstance ) {
+		ptr->mNextInstance->mPrevInstance = ptr->mPrevInstance;
+	}
+	ptr->mPrevInstance = ptr->mNextInstance = nullptr;
+}
+
+template<class T>
+void runtime_class<T>::registerVector( runtime_vector<T>* vector )
+{
+	autoInitialize();
+	std::lock_guard<std::recursive_mutex> listLock( instance()->mListMutex );
+	if( vector->mPrevVector || instance()->mFirstVector == vector ) {
+		return;
+	}
+	vector->mPrevVector = nullptr;
+	vector->mNextVector = instance()->mFirstVector;
+	if( instance()->mFirstVector ) {
+		instance()->mFirstVector->mPrevVector = vector;
+	}
+	instance()->mFirstVector = vector;
+}
+template<class T>
+void runtime_class<T>::unregisterVector( runtime_vector<T>* vector )
+{
+	std::lock_guard<std::recursive_mutex> listLock( instance()->mListMutex );
+	if( vector->mPrevVector ) {
+		vector->mPrevVector->mNextVector = vector->mNextVector;
+	}
+	else if( instance()->mFirstVector == vector ) {
+		instance()->mFirstVector = vector->mNextVector;
+	}
+	else {
+		return;
+	}
+	if( vector->mNextVector ) {
+		vector->mNextVector->mPrevVector = vector->mPrevVector;
+	}
+	vector->mPrevVector = vector->mNextVector = nullptr;
+}
+
+template<class T>
+runtime_ptr<T>::runtime_ptr( bool runtime )
+: mPtr( std::make_shared<T>() ), mRawPtr( mPtr.get() ), mPrevInstance( nullptr ), mNextInstance( nullptr ), mGeneration( 0 )
+{
+	runtime_class<T>::registerInstance( this );
+}
+
+template<class T>
+runtime_ptr<T>::runtime_ptr( const runtime_ptr& other )
+: mPtr( other.mPtr ), mRawPtr( mPtr.get() ), mPrevInstance( nullptr ), mNextInstance( nullptr ), mGeneration( other.mGeneration )
+{
+	runtime_class<T>::registerInstance( this );
+}
+
+template<class T>
+runtime_ptr<T>::runtime_ptr( runtime_ptr&& other )
+: mPtr( std::move( other.mPtr ) ), mRawPtr( mPtr.get() ), mPrevInstance( nullptr ), mNextInstance( nullptr ), mGeneration( other.mGeneration )
+{
+	// the moved-from pointer stays registered until destroyed, empty pointers are skipped by the reloads
+	other.mRawPtr = nullptr;
+	runtime_class<T>::registerInstance( this );
 }
 
 template<class T>
 runtime_ptr<T>& runtime_ptr<T>::operator=( const runtime_ptr& other )
 {
+	// default constructed pointers are registered once they get an instance
 	runtime_class<T>::registerInstance( this );
 	mPtr = other.mPtr;
+	mRawPtr.store( mPtr.get(), std::memory_order_release );
+	mGeneration = other.mGeneration;
 	return *this;
 }
 template<class T>
 runtime_ptr<T>& runtime_ptr<T>::operator=( runtime_ptr&& other )
 {
-	runtime_class<T>::unregisterInstance( &other );
+	if( this == &other ) {
+		return *this;
+	}
 	runtime_class<T>::registerInstance( this );
 	mPtr = std::move( other.mPtr );
+	mRawPtr.store( mPtr.get(), std::memory_order_release );
+	mGeneration = other.mGeneration;
+	other.mRawPtr = nullptr;
 	return *this;
 }
 
@@ -535,23 +1922,173 @@ runtime_ptr<T>::~runtime_ptr()
 }
 
 template<class T>
-std::string runtime_ptr<T>::getName() const
+void runtime_ptr<T>::update( const std::shared_ptr<T> &newInstance )
 {
-	const void *instanceAddress = static_cast<const void*>( this );
-	std::stringstream ss;
-	ss << instanceAddress;
-	return "runtimeInstance" + ss.str();
+	// other threads might still be using the previous instance
+	std::shared_ptr<T> previous = std::move( mPtr );
+	mPtr = newInstance;
+	mRawPtr.store( mPtr.get(), std::memory_order_release );
+	runtime::Reclaimer::get().retire( std::move( previous ) );
 }
 
 template<class T>
-void runtime_ptr<T>::update( const std::shared_ptr<T> &newInstance )
+runtime_vector<T>::runtime_vector( size_t count )
+: mBlock( new T[count], std::default_delete<T[]>() ), mData( mBlock.get() ), mSize( count ), mStride( sizeof( T ) ), mPrevVector( nullptr ), mNextVector( nullptr ), mGeneration( 0 )
 {
-	mPtr = newInstance;
+	runtime_class<T>::registerVector( this );
 }
 
+template<class T>
+runtime_vector<T>::runtime_vector( runtime_vector &&other )
+: mBlock( std::move( other.mBlock ) ), mData( other.mData ), mSize( other.mSize ), mStride( other.mStride ), mPrevVector( nullptr ), mNextVector( nullptr ), mGeneration( other.mGeneration )
+{
+	other.mData = nullptr;
+	other.mSize = 0;
+	runtime_class<T>::registerVector( this );
+}
+
+template<class T>
+runtime_vector<T>& runtime_vector<T>::operator=( runtime_vector &&other )
+{
+	if( this != &other ) {
+		// other threads might still be iterating over the previous block
+		runtime::Reclaimer::get().retire( std::move( mBlock ) );
+		mBlock = std::move( other.mBlock );
+		mData = other.mData;
+		mSize = other.mSize;
+		mStride = other.mStride;
+		mGeneration = other.mGeneration;
+		other.mData = nullptr;
+		other.mSize = 0;
+		// default constructed vectors aren't registered yet
+		runtime_class<T>::registerVector( this );
+	}
+	return *this;
+}
+
+template<class T>
+runtime_vector<T>::~runtime_vector()
+{
+	runtime_class<T>::unregisterVector( this );
+}
+
+template<class T>
+template<class R, class... Args, class... Params>
+void runtime_vector<T>::forEach( R (T::*method)( Args... ), Params&&... params )
+{
+	if( ! mSize ) {
+		return;
+	}
+	// the instances share the same dynamic type so a virtual method resolves to the same function for all of them
+	ptrdiff_t adjustment = 0;
+	auto fn = reinterpret_cast<R (*)( void*, Args... )>( resolveMethod( mData, method, adjustment ) );
+	if( ! fn ) {
+		for( size_t i = 0; i < mSize; ++i ) {
+			( (*this)[i].*method )( params... );
+		}
+		return;
+	}
+	char *data = reinterpret_cast<char*>( mData ) + adjustment;
+	for( size_t i = 0; i < mSize; ++i ) {
+		fn( data + i * mStride, params... );
+	}
+}
+
+template<class T>
+template<class R, class... Args, class... Params>
+void runtime_vector<T>::forEach( R (T::*method)( Args... ) const, Params&&... params ) const
+{
+	if( ! mSize ) {
+		return;
+	}
+	ptrdiff_t adjustment = 0;
+	auto fn = reinterpret_cast<R (*)( const void*, Args... )>( resolveMethod( mData, method, adjustment ) );
+	if( ! fn ) {
+		for( size_t i = 0; i < mSize; ++i ) {
+			( (*this)[i].*method )( params... );
+		}
+		return;
+	}
+	const char *data = reinterpret_cast<const char*>( mData ) + adjustment;
+	for( size_t i = 0; i < mSize; ++i ) {
+		fn( data + i * mStride, params... );
+	}
+}
+
+template<class T>
+template<class Fn>
+void runtime_vector<T>::forEach( const Fn &fn )
+{
+	for( size_t i = 0; i < mSize; ++i ) {
+		fn( (*this)[i] );
+	}
+}
+
+template<class T>
+template<class Method>
+void* runtime_vector<T>::resolveMethod( const T *object, Method method, ptrdiff_t &adjustment )
+{
+#if defined( _MSC_VER )
+	// the Microsoft ABI uses several representations depending on the inheritance of the class, forEach calls the method on each instance instead
+	return nullptr;
+#else
+	// pointers to member functions as defined by the Itanium C++ ABI
+	struct MemberFunction {
+		uintptr_t mPtr;
+		ptrdiff_t mAdj;
+	};
+	if( sizeof( Method ) != sizeof( MemberFunction ) ) {
+		return nullptr;
+	}
+	MemberFunction fn;
+	std::memcpy( &fn, &method, sizeof( fn ) );
+#if defined( __arm__ ) || defined( __aarch64__ )
+	// the ARM variant flags virtual functions in the adjustment
+	bool isVirtual = fn.mAdj & 1;
+	adjustment = fn.mAdj >> 1;
+	uintptr_t vtableOffset = fn.mPtr;
 #else
+	bool isVirtual = fn.mPtr & 1;
+	adjustment = fn.mAdj;
+	uintptr_t vtableOffset = fn.mPtr - 1;
+#endif
+	if( ! isVirtual ) {
+		return reinterpret_cast<void*>( fn.mPtr );
+	}
+	const char *vtable = *reinterpret_cast<const char* const*>( reinterpret_cast<const char*>( object ) + adjustment );
+	return *reinterpret_cast<void* const*>( vtable + vtableOffset );
+#endif
+}
+
+#else
+#include <vector>
+
 template<class T>
 using runtime_ptr = std::shared_ptr<T>;
 template<class T>
 runtime_ptr<T> make_runtime() { return std::make_shared<T>(); }
+
+template<class T>
+class runtime_vector {
+public:
+	runtime_vector() {}
+	explicit runtime_vector( size_t count ) : mInstances( count ) {}
+	
+	size_t size() const { return mInstances.size(); }
+	bool empty() const { return mInstances.empty(); }
+	T& operator[]( size_t index ) { return mInstances[index]; }
+	const T& operator[]( size_t index ) const { return mInstances[index]; }
+	
+	template<class R, class... Args, class... Params>
+	void forEach( R (T::*method)( Args... ), Params&&... params ) { for( auto &instance : mInstances ) { ( instance.*method )( params... ); } }
+	template<class R, class... Args, class... Params>
+	void forEach( R (T::*method)( Args... ) const, Params&&... params ) const { for( const auto &instance : mInstances ) { ( instance.*method )( params... ); } }
+	template<class R, class... Args, class... Params>
+	void forEach( R (T::*method)( Args... ) const, Params&&... params ) { static_cast<const runtime_vector&>( *this ).forEach( method, std::forward<Params>( params )... ); }
+	template<class Fn>
+	void forEach( const Fn &fn ) { for( auto &instance : mInstances ) { fn( instance ); } }
+	
+protected:
+	std::vector<T> mInstances;
+};
 #endif
\ No newline at end of file
@@ -0,0 +1,232 @@
+/*
+ Cinder-Runtime
+ Reclaimer
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace runtime {
+
+//! Keeps the instances replaced by a reload alive until no thread can still be using them. Threads other than the main
+//! one that access runtime_ptrs register themselves and call quiescent() whenever they don't hold any pointer or
+//! reference to an instance, typically between two jobs. Without registered threads the instances are released right away.
+//! Reading an instance is safe while it's being replaced, but not while it's modified in place, which the swap only does
+//! inside an exclusive section, see beginExclusive().
+class Reclaimer {
+public:
+	static Reclaimer& get() { static Reclaimer reclaimer; return reclaimer; }
+
+	//! Registers the calling thread as a reader of runtime_ptrs. The thread has to be unregistered before it exits
+	void registerThread();
+	//! Unregisters the calling thread, which shouldn't use runtime_ptrs anymore
+	void unregisterThread();
+	//! Tells that the calling thread doesn't hold any pointer or reference to an instance. Only costs an atomic load, a store and a fence,
+	//! unless the thread was offline and an exclusive section is in progress, in which case it waits for the section to end
+	void quiescent();
+	//! Tells that the calling thread won't use any instance until its next call to quiescent(), typically before it goes to sleep
+	void offline();
+
+	//! Keeps \a object alive until every registered thread went through a quiescent point
+	void retire( std::shared_ptr<void> object );
+	//! Releases the objects that can't be reached by any thread anymore
+	void collect();
+	//! Returns the number of objects waiting for the registered threads
+	size_t getNumRetired() const { return mNumRetired; }
+	//! Returns the number of threads registered as readers
+	size_t getNumThreads() const { std::lock_guard<std::mutex> lock( mMutex ); return mReaders.size(); }
+
+	//! Starts a section in which no registered thread uses instances, so they can be modified in place. Only succeeds if
+	//! every registered thread is offline, in which case a thread calling quiescent() waits for endExclusive(). Returns false otherwise
+	bool beginExclusive();
+	//! Ends the section started by a successful beginExclusive()
+	void endExclusive();
+	
+	//! Starts an exclusive section for the lifetime of the object if possible
+	class ScopedExclusive {
+	public:
+		ScopedExclusive() : mAcquired( Reclaimer::get().beginExclusive() ) {}
+		~ScopedExclusive() { if( mAcquired ) Reclaimer::get().endExclusive(); }
+		//! Returns whether no other thread can use instances until the object is destroyed
+		bool isAcquired() const { return mAcquired; }
+	protected:
+		bool mAcquired;
+	};
+
+	//! Registers the thread for the lifetime of the object
+	class ScopedThread {
+	public:
+		ScopedThread() { Reclaimer::get().registerThread(); }
+		~ScopedThread() { Reclaimer::get().unregisterThread(); }
+	};
+
+protected:
+	Reclaimer() : mEpoch( 0 ), mNumRetired( 0 ), mExclusive( false ) {}
+
+	struct Reader {
+		Reader( uint64_t epoch ) : mEpoch( epoch ) {}
+		std::atomic<uint64_t> mEpoch;
+	};
+	static std::shared_ptr<Reader>& getThreadReader() { thread_local std::shared_ptr<Reader> reader; return reader; }
+
+	std::atomic<uint64_t>								mEpoch;
+	std::atomic<size_t>									mNumRetired;
+	mutable std::mutex									mMutex;
+	std::vector<std::shared_ptr<Reader>>				mReaders;
+	std::deque<std::pair<uint64_t,std::shared_ptr<void>>>	mRetired;
+	std::atomic<bool>									mExclusive;
+	std::mutex											mExclusiveMutex;
+	std::condition_variable								mExclusiveCondition;
+};
+
+inline void Reclaimer::registerThread()
+{
+	auto &reader = getThreadReader();
+	if( ! reader ) {
+		// the thread starts offline and comes online like any other, waiting for an exclusive section if needed
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			reader = std::make_shared<Reader>( std::numeric_limits<uint64_t>::max() );
+			mReaders.push_back( reader );
+		}
+		quiescent();
+	}
+}
+
+inline void Reclaimer::unregisterThread()
+{
+	auto &reader = getThreadReader();
+	if( reader ) {
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mReaders.erase( std::remove( mReaders.begin(), mReaders.end(), reader ), mReaders.end() );
+		}
+		reader.reset();
+		collect();
+	}
+}
+
+inline void Reclaimer::quiescent()
+{
+	if( const auto &reader = getThreadReader() ) {
+		bool online = reader->mEpoch.load( std::memory_order_relaxed ) != std::numeric_limits<uint64_t>::max();
+		while( true ) {
+			// a store alone can be reordered with the loads that follow it, the fence keeps the instances read afterwards from
+			// being loaded before the new epoch is visible to collect() and beginExclusive()
+			reader->mEpoch.store( mEpoch.load() );
+			std::atomic_thread_fence( std::memory_order_seq_cst );
+			
+			// an online thread can't be in an exclusive section, an offline one waits for it to end before coming back online
+			if( online || ! mExclusive.load() ) {
+				return;
+			}
+			reader->mEpoch.store( std::numeric_limits<uint64_t>::max() );
+			std::unique_lock<std::mutex> lock( mExclusiveMutex );
+			mExclusiveCondition.wait( lock, [this]() { return ! mExclusive.load(); } );
+		}
+	}
+}
+
+inline void Reclaimer::offline()
+{
+	if( const auto &reader = getThreadReader() ) {
+		reader->mEpoch.store( std::numeric_limits<uint64_t>::max() );
+	}
+}
+
+inline bool Reclaimer::beginExclusive()
+{
+	bool expected = false;
+	if( ! mExclusive.compare_exchange_strong( expected, true ) ) {
+		return false;
+	}
+	
+	// pairs with the fence of quiescent(), either the thread sees the section or the section sees the thread online
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	bool offline = true;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		for( const auto &reader : mReaders ) {
+			if( reader->mEpoch.load() != std::numeric_limits<uint64_t>::max() ) {
+				offline = false;
+				break;
+			}
+		}
+	}
+	if( ! offline ) {
+		endExclusive();
+	}
+	return offline;
+}
+
+inline void Reclaimer::endExclusive()
+{
+	{
+		std::lock_guard<std::mutex> lock( mExclusiveMutex );
+		mExclusive = false;
+	}
+	mExclusiveCondition.notify_all();
+}
+
+inline void Reclaimer::retire( std::shared_ptr<void> object )
+{
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		// a thread that reaches this epoch went through a quiescent point after the object became unreachable
+		mRetired.push_back( { mEpoch.fetch_add( 1, std::memory_order_acq_rel ) + 1, std::move( object ) } );
+		mNumRetired = mRetired.size();
+	}
+	collect();
+}
+
+inline void Reclaimer::collect()
+{
+	if( ! mNumRetired ) {
+		return;
+	}
+
+	// the objects are destroyed outside of the lock as their destructor might use runtime_ptrs
+	std::vector<std::shared_ptr<void>> released;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		uint64_t minEpoch = std::numeric_limits<uint64_t>::max();
+		for( const auto &reader : mReaders ) {
+			minEpoch = std::min( minEpoch, reader->mEpoch.load() );
+		}
+		while( ! mRetired.empty() && mRetired.front().first <= minEpoch ) {
+			released.push_back( std::move( mRetired.front().second ) );
+			mRetired.pop_front();
+		}
+		mNumRetired = mRetired.size();
+	}
+}
+
+} // namespace runtime
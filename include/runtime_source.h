@@ -0,0 +1,326 @@
+/*
+ Cinder-Runtime
+ Source
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cinder/Filesystem.h"
+#include "runtime_compiler.h"
+
+namespace runtime {
+
+//! Returns the content of \a path, read at once into a buffer of the size of the file. Returns an empty string if the file can't be read
+inline std::string readFile( const ci::fs::path &path )
+{
+	std::ifstream file( path.c_str(), std::ios::in | std::ios::binary | std::ios::ate );
+	if( ! file ) {
+		return std::string();
+	}
+	std::streamoff size = file.tellg();
+	if( size <= 0 ) {
+		return std::string();
+	}
+	std::string content( static_cast<size_t>( size ), '\0' );
+	file.seekg( 0 );
+	file.read( &content[0], size );
+	content.resize( static_cast<size_t>( file.gcount() ) );
+	return content;
+}
+
+//! Code of a source file with its #include directives set apart
+struct SourceChunk {
+	std::vector<std::string>	mIncludes;
+	std::string					mCode;
+};
+
+//! Splits the sources of the runtime classes and apps into the includes and the code given to the interpreter. The
+//! preprocessor lines are recognized as such, so an #include in a comment or a raw string stays in the code. Each
+//! file is only split again when its content changed since the last reload.
+class SourceAssembler {
+public:
+	static SourceAssembler& get() { static SourceAssembler assembler; return assembler; }
+
+	//! Source of a runtime class or app, ready to be wrapped in the namespace of a generation
+	struct Source {
+		std::vector<std::string>	mIncludes;
+		//! The includes, one per line
+		std::string					mIncludesString;
+		//! Code of the header of a class with a .cpp file, empty otherwise
+		std::string					mDeclarations;
+		//! Code of the header followed by the implementation
+		std::string					mCode;
+	};
+
+	//! Assembles the class at \a path. A .cpp file is preceded by the header of the same name, without the include of that header
+	Source assembleClass( const ci::fs::path &path );
+	//! Assembles the app at \a path, up to the CINDER_RUNTIME_APP macro
+	Source assembleApp( const ci::fs::path &path );
+	//! Returns the includes and code of \a path, without the include of \a skippedInclude and stopping at the first line containing \a stopToken
+	std::shared_ptr<const SourceChunk> getChunk( const ci::fs::path &path, const std::string &skippedInclude = std::string(), const std::string &stopToken = std::string() );
+
+	//! Returns the number of files that had to be split
+	size_t getNumSplits() const { return mNumSplits; }
+	//! Returns the number of files whose chunk was reused because their content didn't change
+	size_t getNumReused() const { return mNumReused; }
+
+	//! Splits \a content into \a chunk. Each line of code is followed by " \n"
+	static void split( const std::string &content, const std::string &skippedInclude, const std::string &stopToken, SourceChunk *chunk );
+
+protected:
+	SourceAssembler() : mNumSplits( 0 ), mNumReused( 0 ) {}
+
+	//! Returns whether the line is an #include directive
+	static bool isInclude( const char *line, size_t length );
+	//! Follows the comments and raw strings of the line, which can span several lines
+	static void scanLine( const char *line, size_t length, bool *inComment, std::string *rawDelimiter );
+
+	struct Entry {
+		uint64_t							mHash;
+		std::shared_ptr<const SourceChunk>	mChunk;
+	};
+
+	std::mutex						mMutex;
+	std::map<std::string,Entry>		mEntries;
+	std::atomic<size_t>				mNumSplits, mNumReused;
+};
+
+inline SourceAssembler::Source SourceAssembler::assembleClass( const ci::fs::path &path )
+{
+	Source source;
+	if( path.extension() != ".cpp" ) {
+		auto chunk = getChunk( path );
+		source.mIncludes = chunk->mIncludes;
+		source.mCode = chunk->mCode;
+	}
+	else {
+		ci::fs::path header = path.parent_path() / ( path.stem().string() + ".h" );
+		auto headerChunk = getChunk( header );
+		auto implChunk = getChunk( path, header.filename().string() );
+		source.mIncludes = headerChunk->mIncludes;
+		source.mIncludes.insert( source.mIncludes.end(), implChunk->mIncludes.begin(), implChunk->mIncludes.end() );
+		source.mDeclarations = headerChunk->mCode;
+		source.mCode.reserve( headerChunk->mCode.size() + implChunk->mCode.size() );
+		source.mCode = headerChunk->mCode;
+		source.mCode += implChunk->mCode;
+	}
+	for( const auto &include : source.mIncludes ) {
+		source.mIncludesString += include + "\n";
+	}
+	return source;
+}
+
+inline SourceAssembler::Source SourceAssembler::assembleApp( const ci::fs::path &path )
+{
+	Source source;
+	auto chunk = getChunk( path, std::string(), "CINDER_RUNTIME_APP" );
+	source.mIncludes = chunk->mIncludes;
+	source.mCode = chunk->mCode;
+	for( const auto &include : source.mIncludes ) {
+		source.mIncludesString += include + "\n";
+	}
+	return source;
+}
+
+inline std::shared_ptr<const SourceChunk> SourceAssembler::getChunk( const ci::fs::path &path, const std::string &skippedInclude, const std::string &stopToken )
+{
+	// reading and hashing the file is much cheaper than splitting it again
+	std::string content = readFile( path );
+	uint64_t contentHash = hash( content );
+	std::string key = path.string() + "|" + skippedInclude + "|" + stopToken;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		auto entry = mEntries.find( key );
+		if( entry != mEntries.end() && entry->second.mHash == contentHash ) {
+			mNumReused++;
+			return entry->second.mChunk;
+		}
+	}
+
+	auto chunk = std::make_shared<SourceChunk>();
+	split( content, skippedInclude, stopToken, chunk.get() );
+	mNumSplits++;
+	std::lock_guard<std::mutex> lock( mMutex );
+	mEntries[key] = { contentHash, chunk };
+	return chunk;
+}
+
+inline void SourceAssembler::split( const std::string &content, const std::string &skippedInclude, const std::string &stopToken, SourceChunk *chunk )
+{
+	// the code is at most the size of the file plus the two characters added to each line
+	size_t numLines = std::count( content.begin(), content.end(), '\n' ) + 1;
+	chunk->mCode.reserve( content.size() + numLines * 2 );
+
+	bool inComment = false;
+	std::string rawDelimiter;
+	for( size_t begin = 0; begin < content.size(); ) {
+		size_t end = content.find( '\n', begin );
+		if( end == std::string::npos ) {
+			end = content.size();
+		}
+		const char *line = content.data() + begin;
+		size_t length = end - begin;
+		begin = end + 1;
+
+		if( ! stopToken.empty() && std::string( line, length ).find( stopToken ) != std::string::npos ) {
+			break;
+		}
+		bool include = ! inComment && rawDelimiter.empty() && isInclude( line, length );
+		scanLine( line, length, &inComment, &rawDelimiter );
+		if( include ) {
+			std::string directive( line, length );
+			if( skippedInclude.empty() || directive.find( skippedInclude ) == std::string::npos ) {
+				chunk->mIncludes.push_back( directive );
+			}
+		}
+		else {
+			chunk->mCode.append( line, length );
+			chunk->mCode.append( " \n" );
+		}
+	}
+}
+
+inline bool SourceAssembler::isInclude( const char *line, size_t length )
+{
+	size_t i = 0;
+	while( i < length && ( line[i] == ' ' || line[i] == '\t' ) ) {
+		++i;
+	}
+	if( i == length || line[i] != '#' ) {
+		return false;
+	}
+	++i;
+	while( i < length && ( line[i] == ' ' || line[i] == '\t' ) ) {
+		++i;
+	}
+	static const char directive[] = "include";
+	static const size_t directiveLength = sizeof( directive ) - 1;
+	if( length - i < directiveLength || std::strncmp( line + i, directive, directiveLength ) != 0 ) {
+		return false;
+	}
+	// #include_next is kept with the includes as well, other identifiers starting the same way aren't includes
+	i += directiveLength;
+	if( length - i >= 5 && std::strncmp( line + i, "_next", 5 ) == 0 ) {
+		i += 5;
+	}
+	return i == length || ! ( std::isalnum( static_cast<unsigned char>( line[i] ) ) || line[i] == '_' );
+}
+
+inline void SourceAssembler::scanLine( const char *line, size_t length, bool *inComment, std::string *rawDelimiter )
+{
+	auto isIdentifier = []( char c ) { return std::isalnum( static_cast<unsigned char>( c ) ) || c == '_'; };
+	// a quote inside a number is a digit separator, after a prefix like L, u, U or u8 it starts a character literal
+	auto isDigitSeparator = [&]( const char *quote ) {
+		const char *token = quote;
+		while( token > line && isIdentifier( token[-1] ) ) {
+			--token;
+		}
+		return token < quote && std::isdigit( static_cast<unsigned char>( *token ) );
+	};
+	const char *end = line + length;
+	const char *c = line;
+	
+	// the state is kept in locals so the loops over the characters stay tight
+	bool comment = *inComment;
+	std::string delimiter;
+	std::swap( delimiter, *rawDelimiter );
+	while( c < end ) {
+		if( comment ) {
+			c = static_cast<const char*>( std::memchr( c, '*', end - c ) );
+			if( ! c ) {
+				break;
+			}
+			if( c + 1 < end && c[1] == '/' ) {
+				comment = false;
+				c += 2;
+			}
+			else {
+				++c;
+			}
+		}
+		else if( ! delimiter.empty() ) {
+			// the delimiter is stored with its closing quote
+			c = static_cast<const char*>( std::memchr( c, ')', end - c ) );
+			if( ! c ) {
+				break;
+			}
+			if( static_cast<size_t>( end - c - 1 ) >= delimiter.size() && delimiter.compare( 0, delimiter.size(), c + 1, delimiter.size() ) == 0 ) {
+				c += delimiter.size();
+				delimiter.clear();
+			}
+			++c;
+		}
+		else {
+			// only slashes and quotes can start a comment or a literal
+			while( c < end && *c != '/' && *c != '"' && *c != '\'' ) {
+				++c;
+			}
+			if( c == end ) {
+				break;
+			}
+			if( *c == '/' ) {
+				if( c + 1 < end && c[1] == '/' ) {
+					break;
+				}
+				if( c + 1 < end && c[1] == '*' ) {
+					comment = true;
+					++c;
+				}
+				++c;
+			}
+			else if( *c == '"' && c > line && c[-1] == 'R' && ( c - 1 == line || ! isIdentifier( c[-2] ) || c[-2] == 'u' || c[-2] == 'U' || c[-2] == 'L' || c[-2] == '8' ) ) {
+				const char *open = c + 1;
+				while( open < end && *open != '(' ) {
+					++open;
+				}
+				delimiter = std::string( c + 1, open ) + "\"";
+				c = open < end ? open + 1 : end;
+			}
+			else if( *c == '\'' && isDigitSeparator( c ) ) {
+				++c;
+			}
+			else {
+				// regular literals end on the same line
+				char quote = *c++;
+				while( c < end && *c != quote ) {
+					c += *c == '\\' && c + 1 < end ? 2 : 1;
+				}
+				c = c < end ? c + 1 : end;
+			}
+		}
+	}
+	*inComment = comment;
+	std::swap( delimiter, *rawDelimiter );
+}
+
+} // namespace runtime
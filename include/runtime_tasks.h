@@ -0,0 +1,227 @@
+/*
+ Cinder-Runtime
+ Tasks
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "runtime_reclaimer.h"
+
+namespace runtime {
+
+//! Work-stealing thread pool running the batches of parallelForEach. Each thread has its own queue, takes its tasks
+//! from the front and steals from the back of the others once it's empty. The pool threads are registered with the Reclaimer
+class TaskPool {
+public:
+	static TaskPool& get() { static TaskPool pool; return pool; }
+
+	//! Calls \a fn( begin, end ) for ranges of at most \a grainSize indices covering [0, count). The calling thread
+	//! takes part in the work and the function returns once every range has been processed
+	void parallelFor( size_t count, size_t grainSize, const std::function<void(size_t,size_t)> &fn );
+	//! Returns the number of threads of the pool, not counting the threads calling parallelFor
+	size_t getNumThreads() const { return mWorkers.size(); }
+	//! Limits the number of threads of the pool taking part in parallelFor, mostly to measure how the work scales. Not to be called during a parallelFor
+	void setMaxThreads( size_t count );
+	//! Returns the number of threads of the pool taking part in parallelFor
+	size_t getMaxThreads() const { return mMaxThreads; }
+
+	~TaskPool();
+
+protected:
+	TaskPool();
+	void run( size_t index );
+
+	struct Batch {
+		Batch( size_t numTasks ) : mRemaining( numTasks ) {}
+		size_t						mRemaining;
+		std::mutex					mMutex;
+		std::condition_variable		mCondition;
+	};
+	struct Task {
+		const std::function<void(size_t,size_t)>*	mFn;
+		size_t										mBegin, mEnd;
+		Batch*										mBatch;
+	};
+	struct Worker {
+		std::mutex					mMutex;
+		std::deque<Task>			mTasks;
+		std::thread					mThread;
+	};
+
+	//! Takes a task from the queue of the worker \a index or steals one from another queue. Threads outside of the pool only steal
+	bool pop( size_t index, Task &task );
+	void execute( const Task &task );
+
+	bool									mQuit;
+	std::atomic<size_t>						mNumPending, mMaxThreads;
+	std::mutex								mMutex;
+	std::condition_variable					mCondition;
+	std::vector<std::unique_ptr<Worker>>	mWorkers;
+};
+
+inline TaskPool::TaskPool()
+: mQuit( false ), mNumPending( 0 ), mMaxThreads( 0 )
+{
+	// the reclaimer has to outlive the pool threads
+	Reclaimer::get();
+
+	// the thread calling parallelFor works as well
+	size_t numThreads = std::max( std::thread::hardware_concurrency(), 1u ) - 1;
+	for( size_t i = 0; i < numThreads; ++i ) {
+		mWorkers.emplace_back( new Worker() );
+	}
+	for( size_t i = 0; i < numThreads; ++i ) {
+		mWorkers[i]->mThread = std::thread( &TaskPool::run, this, i );
+	}
+	mMaxThreads = numThreads;
+}
+
+inline TaskPool::~TaskPool()
+{
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mQuit = true;
+	}
+	mCondition.notify_all();
+	for( auto &worker : mWorkers ) {
+		if( worker->mThread.joinable() ) {
+			worker->mThread.join();
+		}
+	}
+}
+
+inline void TaskPool::setMaxThreads( size_t count )
+{
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mMaxThreads = std::min( count, mWorkers.size() );
+	}
+	mCondition.notify_all();
+}
+
+inline void TaskPool::parallelFor( size_t count, size_t grainSize, const std::function<void(size_t,size_t)> &fn )
+{
+	grainSize = std::max<size_t>( grainSize, 1 );
+	size_t numTasks = ( count + grainSize - 1 ) / grainSize;
+	size_t numWorkers = mMaxThreads;
+	if( numTasks <= 1 || ! numWorkers ) {
+		if( count ) {
+			fn( 0, count );
+		}
+		return;
+	}
+
+	// spread the ranges over the queues, the threads balance the work by stealing from each other
+	Batch batch( numTasks );
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mNumPending += numTasks;
+		for( size_t i = 0; i < numTasks; ++i ) {
+			auto &worker = *mWorkers[i % numWorkers];
+			std::lock_guard<std::mutex> workerLock( worker.mMutex );
+			worker.mTasks.push_back( { &fn, i * grainSize, std::min( count, ( i + 1 ) * grainSize ), &batch } );
+		}
+	}
+	mCondition.notify_all();
+
+	// help until all the ranges are done
+	Task task;
+	while( true ) {
+		if( pop( numWorkers, task ) ) {
+			execute( task );
+			continue;
+		}
+		std::unique_lock<std::mutex> lock( batch.mMutex );
+		batch.mCondition.wait( lock, [&batch]() { return batch.mRemaining == 0; } );
+		break;
+	}
+}
+
+inline bool TaskPool::pop( size_t index, Task &task )
+{
+	// the queues of the threads left out by setMaxThreads are always empty
+	size_t numWorkers = std::min<size_t>( mMaxThreads, mWorkers.size() );
+	for( size_t i = 0; i < numWorkers; ++i ) {
+		auto &worker = *mWorkers[( index + i ) % numWorkers];
+		std::lock_guard<std::mutex> lock( worker.mMutex );
+		if( worker.mTasks.empty() ) {
+			continue;
+		}
+		if( i == 0 && index < numWorkers ) {
+			task = worker.mTasks.front();
+			worker.mTasks.pop_front();
+		}
+		else {
+			task = worker.mTasks.back();
+			worker.mTasks.pop_back();
+		}
+		mNumPending--;
+		return true;
+	}
+	return false;
+}
+
+inline void TaskPool::execute( const Task &task )
+{
+	(*task.mFn)( task.mBegin, task.mEnd );
+
+	// the batch lives on the stack of the calling thread, which only returns once the lock is released
+	std::lock_guard<std::mutex> lock( task.mBatch->mMutex );
+	if( --task.mBatch->mRemaining == 0 ) {
+		task.mBatch->mCondition.notify_all();
+	}
+}
+
+inline void TaskPool::run( size_t index )
+{
+	Reclaimer::ScopedThread reader;
+	while( true ) {
+		Task task;
+		if( pop( index, task ) ) {
+			execute( task );
+			Reclaimer::get().quiescent();
+			continue;
+		}
+
+		// sleeping threads don't hold back the release of swapped instances
+		Reclaimer::get().offline();
+		{
+			std::unique_lock<std::mutex> lock( mMutex );
+			mCondition.wait( lock, [this,index]() { return mQuit || ( mNumPending > 0 && index < mMaxThreads ); } );
+			if( mQuit ) {
+				return;
+			}
+		}
+		Reclaimer::get().quiescent();
+	}
+}
+
+} // namespace runtime
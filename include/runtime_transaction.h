@@ -0,0 +1,278 @@
+/*
+ Cinder-Runtime
+ Transaction
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cinder/Log.h"
+#include "runtime_compiler.h"
+
+namespace runtime {
+
+//! Reloads several runtime classes as a single transaction: the classes of a reload group, or the classes depending
+//! on a header that changed. Every class of the transaction is compiled on the compile thread first, then the new
+//! generations are published together and swapped at the start of the same frame. If one of the classes fails to
+//! compile none of the new generations is published.
+class ReloadTransactions {
+public:
+	static ReloadTransactions& get() { static ReloadTransactions transactions; return transactions; }
+
+	//! Outcome of the compilation of a class taking part in a transaction
+	enum class CompileResult { FAILED, UNCHANGED, COMPILED };
+
+	//! Entry points of a class taking part in transactions
+	struct Member {
+		std::string								mName;
+		//! Compiles the new generation of the class on the compile thread, or its optimized tier if the argument is true, keeping it aside
+		std::function<CompileResult(bool)>		mCompile;
+		//! Commits the generation put aside by mCompile if the argument is true, unloads it otherwise. Only called after mCompile returned COMPILED
+		std::function<void(bool)>				mFinish;
+		//! Locks what the swap needs on the main thread without blocking. Returns nullptr if the class is busy
+		std::function<std::shared_ptr<void>()>	mLock;
+		//! Swaps every instance of the class to the committed generation, called with the lock held. Returns whether the instances were swapped
+		std::function<bool()>					mSwap;
+		//! Notifies that the instances were swapped, called once every lock is released
+		std::function<void()>					mSwapped;
+	};
+
+	//! Adds \a member, replacing the member with the same name, to \a group unless it's empty
+	void add( const std::string &group, const Member &member );
+	//! Adds \a names to the transaction queued as \a key, which runs on the compile thread once no class has been added to it for \a window seconds
+	void queue( const std::string &key, const std::vector<std::string> &names, double window );
+	//! Compiles the classes of \a group and publishes them together if all of them compiled. Called on the compile thread
+	bool reload( const std::string &group );
+	//! Compiles the classes \a names, along with the other members of their groups, or their optimized tier if \a optimized is true, and publishes them together if all of them compiled. Called on the compile thread
+	bool reload( const std::vector<std::string> &names, bool optimized );
+	//! Swaps the classes of the published transactions, in the order they were published. Called on the main thread
+	void apply();
+	//! Returns the names of the members of \a group
+	std::vector<std::string> getMembers( const std::string &group ) const;
+	//! Returns the number of transactions involving \a group that have been published
+	size_t getNumCommitted( const std::string &group ) const;
+	//! Returns the number of transactions involving \a group cancelled by a failed compilation
+	size_t getNumCancelled( const std::string &group ) const;
+
+protected:
+	ReloadTransactions() {}
+
+	struct Group {
+		Group() : mNumCommitted( 0 ), mNumCancelled( 0 ) {}
+		std::vector<std::string>	mMembers;
+		size_t						mNumCommitted, mNumCancelled;
+	};
+	struct Entry {
+		Member						mMember;
+		std::string					mGroup;
+	};
+
+	mutable std::mutex							mMutex;
+	std::map<std::string,Entry>					mMembers;
+	std::map<std::string,Group>					mGroups;
+	std::map<std::string,std::set<std::string>>	mQueued;
+	// members of the transactions published and not swapped yet
+	std::deque<std::vector<Member>>				mPublished;
+};
+
+inline void ReloadTransactions::add( const std::string &group, const Member &member )
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	mMembers[member.mName] = { member, group };
+	if( ! group.empty() ) {
+		auto &members = mGroups[group].mMembers;
+		if( std::find( members.begin(), members.end(), member.mName ) == members.end() ) {
+			members.push_back( member.mName );
+		}
+	}
+}
+
+inline void ReloadTransactions::queue( const std::string &key, const std::vector<std::string> &names, double window )
+{
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mQueued[key].insert( names.begin(), names.end() );
+	}
+	
+	// the classes added during the window are compiled by the same job
+	CompileWorker::get().enqueue( "transaction:" + key, window, [this,key]() {
+		std::set<std::string> queued;
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			std::swap( queued, mQueued[key] );
+		}
+		reload( std::vector<std::string>( queued.begin(), queued.end() ), false );
+	} );
+}
+
+inline bool ReloadTransactions::reload( const std::string &group )
+{
+	return reload( getMembers( group ), false );
+}
+
+inline bool ReloadTransactions::reload( const std::vector<std::string> &names, bool optimized )
+{
+	// the members of a group are always reloaded together
+	std::vector<Member> members;
+	std::set<std::string> groups;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		std::set<std::string> added;
+		for( const auto &name : names ) {
+			auto entry = mMembers.find( name );
+			if( entry == mMembers.end() ) {
+				continue;
+			}
+			std::vector<std::string> related = { name };
+			if( ! entry->second.mGroup.empty() ) {
+				groups.insert( entry->second.mGroup );
+				related = mGroups[entry->second.mGroup].mMembers;
+			}
+			for( const auto &member : related ) {
+				if( added.insert( member ).second ) {
+					members.push_back( mMembers[member].mMember );
+				}
+			}
+		}
+	}
+
+	// the classes are compiled without the lock, the main thread keeps swapping the previous transactions meanwhile
+	std::vector<Member> compiled;
+	std::vector<std::string> failed;
+	for( const auto &member : members ) {
+		CompileResult result = member.mCompile( optimized );
+		if( result == CompileResult::COMPILED ) {
+			compiled.push_back( member );
+		}
+		else if( result == CompileResult::FAILED ) {
+			failed.push_back( member.mName );
+		}
+	}
+	if( compiled.empty() && failed.empty() ) {
+		return true;
+	}
+	
+	// the generations are committed under the lock so apply never sees only part of them
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		for( const auto &member : compiled ) {
+			member.mFinish( failed.empty() );
+		}
+		for( const auto &group : groups ) {
+			failed.empty() ? mGroups[group].mNumCommitted++ : mGroups[group].mNumCancelled++;
+		}
+		if( failed.empty() ) {
+			mPublished.push_back( compiled );
+		}
+	}
+	if( ! failed.empty() ) {
+		std::string names;
+		for( const auto &name : failed ) {
+			names += ( names.empty() ? "" : ", " ) + name;
+		}
+		CI_LOG_E( "Reload transaction cancelled, " << names << " failed to compile" );
+		return false;
+	}
+	
+	// with tiered compilation the classes are compiled again with optimizations, still as a single transaction
+	if( ! optimized && ! CompileWorker::get().isStopping() ) {
+		std::vector<std::string> committed;
+		for( const auto &member : compiled ) {
+			committed.push_back( member.mName );
+		}
+		CompileWorker::get().enqueue( [this,committed]() {
+			reload( committed, true );
+		} );
+	}
+	return true;
+}
+
+inline void ReloadTransactions::apply()
+{
+	while( true ) {
+		std::vector<Member> members;
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			if( mPublished.empty() ) {
+				return;
+			}
+			members = std::move( mPublished.front() );
+			mPublished.pop_front();
+		}
+		
+		// the whole transaction waits for the next frame if one of the classes is busy, only the main thread takes transactions out of the queue
+		std::vector<std::shared_ptr<void>> locks;
+		for( const auto &member : members ) {
+			auto memberLock = member.mLock();
+			if( ! memberLock ) {
+				break;
+			}
+			locks.push_back( memberLock );
+		}
+		if( locks.size() < members.size() ) {
+			std::lock_guard<std::mutex> lock( mMutex );
+			mPublished.push_front( std::move( members ) );
+			return;
+		}
+		std::vector<Member> swapped;
+		for( const auto &member : members ) {
+			if( member.mSwap() ) {
+				swapped.push_back( member );
+			}
+		}
+		locks.clear();
+		for( const auto &member : swapped ) {
+			member.mSwapped();
+		}
+	}
+}
+
+inline std::vector<std::string> ReloadTransactions::getMembers( const std::string &group ) const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	auto entry = mGroups.find( group );
+	return entry != mGroups.end() ? entry->second.mMembers : std::vector<std::string>();
+}
+
+inline size_t ReloadTransactions::getNumCommitted( const std::string &group ) const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	auto entry = mGroups.find( group );
+	return entry != mGroups.end() ? entry->second.mNumCommitted : 0;
+}
+
+inline size_t ReloadTransactions::getNumCancelled( const std::string &group ) const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	auto entry = mGroups.find( group );
+	return entry != mGroups.end() ? entry->second.mNumCancelled : 0;
+}
+
+} // namespace runtime
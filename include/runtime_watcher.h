@@ -0,0 +1,510 @@
+/*
+ Cinder-Runtime
+ Watcher
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#if defined( __linux__ )
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#elif defined( __APPLE__ )
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/event.h>
+#include <unistd.h>
+#endif
+
+#include "cinder/Filesystem.h"
+
+namespace runtime {
+
+//! Watches the sources of every runtime class and app from a single thread. On Linux the thread sleeps on inotify
+//! until one of the watched directories changes, on macOS on a kqueue watching the files and their directories,
+//! other platforms compare the modification times of the files every 100ms. Changes detected together are
+//! dispatched in a single call to each callback.
+class WatchService {
+public:
+	typedef std::function<void(const std::vector<ci::fs::path>&)> Callback;
+
+	static WatchService& get() { static WatchService service; return service; }
+
+	//! Calls \a callback on the watch thread with the files of \a paths that changed. Returns an id that can be passed to unwatch()
+	size_t watch( const std::vector<ci::fs::path> &paths, const Callback &callback );
+	//! Stops dispatching changes to the callback registered with \a id and stops watching the files no other callback needs
+	void unwatch( size_t id );
+	//! Returns the number of files watched
+	size_t getNumWatchedFiles() const;
+	//! Returns the average time in seconds between the last modification of a file and the dispatch of its change
+	double getAverageLatency() const;
+
+	~WatchService();
+
+protected:
+	WatchService();
+	void run();
+	void dispatch( const std::set<std::string> &changed );
+	//! Returns the modification time of \a path in nanoseconds, 0 if the file doesn't exist
+	static int64_t getModificationTime( const std::string &path );
+#if defined( __APPLE__ )
+	//! Starts watching the file or directory \a path with the kqueue, returns its descriptor or -1
+	int addVnode( const std::string &path );
+#endif
+
+	struct Watch {
+		size_t					mId;
+		std::set<std::string>	mPaths;
+		Callback				mCallback;
+	};
+
+	mutable std::mutex					mMutex;
+	std::vector<Watch>					mWatches;
+	size_t								mNextId;
+	bool								mQuit;
+	double								mLatencySum;
+	size_t								mNumLatencies;
+#if defined( __linux__ )
+	int									mInotify;
+	int									mWakePipe[2];
+	// watched directories by watch descriptor, editors often save by renaming a temporary file over the original
+	std::map<int,std::string>			mDirectories;
+#elif defined( __APPLE__ )
+	int									mKqueue;
+	int									mWakePipe[2];
+	// watched directories and files by descriptor. A directory only reports that one of its entries changed, which is
+	// how a save renaming a temporary file over the original shows up, the modification times tell which file it was
+	std::map<int,std::string>			mDirectories, mFiles;
+	std::map<std::string,int64_t>		mModificationTimes;
+#else
+	std::condition_variable				mCondition;
+	std::map<std::string,int64_t>		mModificationTimes;
+#endif
+	std::thread							mThread;
+};
+
+inline WatchService::WatchService()
+: mNextId( 0 ), mQuit( false ), mLatencySum( 0.0 ), mNumLatencies( 0 )
+{
+#if defined( __linux__ )
+	mInotify = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+	if( pipe( mWakePipe ) != 0 ) {
+		mWakePipe[0] = mWakePipe[1] = -1;
+	}
+#elif defined( __APPLE__ )
+	mKqueue = kqueue();
+	if( pipe( mWakePipe ) != 0 ) {
+		mWakePipe[0] = mWakePipe[1] = -1;
+	}
+	else {
+		struct kevent change;
+		EV_SET( &change, mWakePipe[0], EVFILT_READ, EV_ADD, 0, 0, nullptr );
+		kevent( mKqueue, &change, 1, nullptr, 0, nullptr );
+	}
+#endif
+	mThread = std::thread( &WatchService::run, this );
+}
+
+inline WatchService::~WatchService()
+{
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mQuit = true;
+	}
+#if defined( __linux__ ) || defined( __APPLE__ )
+	if( mWakePipe[1] >= 0 ) {
+		char wake = 0;
+		ssize_t written = write( mWakePipe[1], &wake, 1 );
+		(void) written;
+	}
+#else
+	mCondition.notify_one();
+#endif
+	if( mThread.joinable() ) {
+		mThread.join();
+	}
+#if defined( __linux__ )
+	for( int fd : { mInotify, mWakePipe[0], mWakePipe[1] } ) {
+		if( fd >= 0 ) {
+			close( fd );
+		}
+	}
+#elif defined( __APPLE__ )
+	for( const auto &directory : mDirectories ) {
+		close( directory.first );
+	}
+	for( const auto &file : mFiles ) {
+		close( file.first );
+	}
+	for( int fd : { mKqueue, mWakePipe[0], mWakePipe[1] } ) {
+		if( fd >= 0 ) {
+			close( fd );
+		}
+	}
+#endif
+}
+
+inline size_t WatchService::watch( const std::vector<ci::fs::path> &paths, const Callback &callback )
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	Watch watch = { mNextId++, {}, callback };
+	for( const auto &path : paths ) {
+		ci::fs::path absolutePath = ci::fs::exists( path ) ? ci::fs::canonical( path ) : ci::fs::absolute( path );
+		watch.mPaths.insert( absolutePath.string() );
+#if defined( __linux__ )
+		std::string directory = absolutePath.parent_path().string();
+		int wd = inotify_add_watch( mInotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE );
+		if( wd >= 0 ) {
+			mDirectories[wd] = directory;
+		}
+#elif defined( __APPLE__ )
+		// the files are watched for writes in place, their directory for files renamed over them or created
+		std::string file = absolutePath.string();
+		std::string directory = absolutePath.parent_path().string();
+		if( ! mModificationTimes.count( file ) ) {
+			mModificationTimes[file] = getModificationTime( file );
+			int fd = addVnode( file );
+			if( fd >= 0 ) {
+				mFiles[fd] = file;
+			}
+		}
+		bool watched = false;
+		for( const auto &watchedDirectory : mDirectories ) {
+			watched = watched || watchedDirectory.second == directory;
+		}
+		if( ! watched ) {
+			int fd = addVnode( directory );
+			if( fd >= 0 ) {
+				mDirectories[fd] = directory;
+			}
+		}
+#else
+		if( ! mModificationTimes.count( absolutePath.string() ) ) {
+			mModificationTimes[absolutePath.string()] = getModificationTime( absolutePath.string() );
+		}
+#endif
+	}
+	mWatches.push_back( watch );
+	return watch.mId;
+}
+
+inline void WatchService::unwatch( size_t id )
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	for( auto it = mWatches.begin(); it != mWatches.end(); ++it ) {
+		if( it->mId == id ) {
+			mWatches.erase( it );
+			break;
+		}
+	}
+	
+	// release what isn't used by the remaining watches
+	std::set<std::string> paths;
+	for( const auto &watch : mWatches ) {
+		paths.insert( watch.mPaths.begin(), watch.mPaths.end() );
+	}
+#if defined( __linux__ )
+	std::set<std::string> directories;
+	for( const auto &path : paths ) {
+		directories.insert( ci::fs::path( path ).parent_path().string() );
+	}
+	for( auto it = mDirectories.begin(); it != mDirectories.end(); ) {
+		if( ! directories.count( it->second ) ) {
+			inotify_rm_watch( mInotify, it->first );
+			it = mDirectories.erase( it );
+		}
+		else {
+			++it;
+		}
+	}
+#elif defined( __APPLE__ )
+	// closing a descriptor removes its events from the kqueue
+	std::set<std::string> directories;
+	for( const auto &path : paths ) {
+		directories.insert( ci::fs::path( path ).parent_path().string() );
+	}
+	for( auto it = mDirectories.begin(); it != mDirectories.end(); ) {
+		if( ! directories.count( it->second ) ) {
+			close( it->first );
+			it = mDirectories.erase( it );
+		}
+		else {
+			++it;
+		}
+	}
+	for( auto it = mFiles.begin(); it != mFiles.end(); ) {
+		if( ! paths.count( it->second ) ) {
+			close( it->first );
+			it = mFiles.erase( it );
+		}
+		else {
+			++it;
+		}
+	}
+	for( auto it = mModificationTimes.begin(); it != mModificationTimes.end(); ) {
+		if( ! paths.count( it->first ) ) {
+			it = mModificationTimes.erase( it );
+		}
+		else {
+			++it;
+		}
+	}
+#else
+	for( auto it = mModificationTimes.begin(); it != mModificationTimes.end(); ) {
+		if( ! paths.count( it->first ) ) {
+			it = mModificationTimes.erase( it );
+		}
+		else {
+			++it;
+		}
+	}
+#endif
+}
+
+inline size_t WatchService::getNumWatchedFiles() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	std::set<std::string> paths;
+	for( const auto &watch : mWatches ) {
+		paths.insert( watch.mPaths.begin(), watch.mPaths.end() );
+	}
+	return paths.size();
+}
+
+inline double WatchService::getAverageLatency() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	return mNumLatencies ? mLatencySum / mNumLatencies : 0.0;
+}
+
+inline int64_t WatchService::getModificationTime( const std::string &path )
+{
+	struct stat info;
+	if( stat( path.c_str(), &info ) != 0 ) {
+		return 0;
+	}
+#if defined( __APPLE__ )
+	return static_cast<int64_t>( info.st_mtimespec.tv_sec ) * 1000000000 + info.st_mtimespec.tv_nsec;
+#elif defined( __linux__ )
+	return static_cast<int64_t>( info.st_mtim.tv_sec ) * 1000000000 + info.st_mtim.tv_nsec;
+#else
+	return static_cast<int64_t>( info.st_mtime ) * 1000000000;
+#endif
+}
+
+#if defined( __APPLE__ )
+inline int WatchService::addVnode( const std::string &path )
+{
+	int fd = open( path.c_str(), O_EVTONLY );
+	if( fd < 0 ) {
+		return -1;
+	}
+	struct kevent change;
+	EV_SET( &change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, nullptr );
+	if( kevent( mKqueue, &change, 1, nullptr, 0, nullptr ) < 0 ) {
+		close( fd );
+		return -1;
+	}
+	return fd;
+}
+#endif
+
+inline void WatchService::dispatch( const std::set<std::string> &changed )
+{
+	// the callbacks are called without the lock so they can watch other files
+	std::vector<std::pair<Callback,std::vector<ci::fs::path>>> calls;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::system_clock::now().time_since_epoch() ).count();
+		for( const auto &watch : mWatches ) {
+			std::vector<ci::fs::path> files;
+			for( const auto &path : changed ) {
+				if( watch.mPaths.count( path ) ) {
+					files.push_back( path );
+					if( int64_t modificationTime = getModificationTime( path ) ) {
+						mLatencySum += static_cast<double>( now - modificationTime ) / 1000000000.0;
+						mNumLatencies++;
+					}
+				}
+			}
+			if( ! files.empty() ) {
+				calls.push_back( { watch.mCallback, files } );
+			}
+		}
+	}
+	for( const auto &call : calls ) {
+		call.first( call.second );
+	}
+}
+
+inline void WatchService::run()
+{
+#if defined( __linux__ )
+	// without the wake pipe the thread can't be woken up, it checks mQuit every 100ms instead
+	int timeout = mWakePipe[0] >= 0 ? -1 : 100;
+	while( true ) {
+		pollfd fds[2] = { { mInotify, POLLIN, 0 }, { mWakePipe[0], POLLIN, 0 } };
+		int result = poll( fds, 2, timeout );
+		if( result < 0 && errno != EINTR ) {
+			return;
+		}
+		if( fds[1].revents ) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			if( mQuit ) {
+				return;
+			}
+		}
+		if( result <= 0 ) {
+			continue;
+		}
+
+		// read every pending event before dispatching them
+		std::set<std::string> changed;
+		alignas( inotify_event ) char buffer[4096];
+		ssize_t length;
+		while( ( length = read( mInotify, buffer, sizeof( buffer ) ) ) > 0 ) {
+			std::lock_guard<std::mutex> lock( mMutex );
+			for( char *ptr = buffer; ptr < buffer + length; ) {
+				const inotify_event *event = reinterpret_cast<const inotify_event*>( ptr );
+				auto directory = mDirectories.find( event->wd );
+				if( event->len && directory != mDirectories.end() ) {
+					changed.insert( directory->second + "/" + event->name );
+				}
+				ptr += sizeof( inotify_event ) + event->len;
+			}
+		}
+		if( ! changed.empty() ) {
+			dispatch( changed );
+		}
+	}
+#elif defined( __APPLE__ )
+	// without the wake pipe the thread can't be woken up, it checks mQuit every 100ms instead
+	timespec interval = { 0, 100000000 };
+	const timespec *timeout = mWakePipe[0] >= 0 ? nullptr : &interval;
+	while( true ) {
+		struct kevent events[64];
+		int result = kevent( mKqueue, nullptr, 0, events, 64, timeout );
+		if( result < 0 && errno != EINTR ) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			if( mQuit ) {
+				return;
+			}
+		}
+		if( result <= 0 ) {
+			continue;
+		}
+		
+		std::set<std::string> changed;
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			// a file reports its own writes, a directory any of its files being replaced or created
+			std::set<std::string> directories;
+			for( int i = 0; i < result; ++i ) {
+				int fd = static_cast<int>( events[i].ident );
+				if( events[i].filter != EVFILT_VNODE ) {
+					continue;
+				}
+				auto file = mFiles.find( fd );
+				if( file != mFiles.end() ) {
+					changed.insert( file->second );
+				}
+				auto directory = mDirectories.find( fd );
+				if( directory != mDirectories.end() ) {
+					directories.insert( directory->second );
+				}
+			}
+			for( auto &modificationTime : mModificationTimes ) {
+				if( ! directories.count( ci::fs::path( modificationTime.first ).parent_path().string() ) ) {
+					continue;
+				}
+				int64_t time = getModificationTime( modificationTime.first );
+				if( time != modificationTime.second ) {
+					modificationTime.second = time;
+					changed.insert( modificationTime.first );
+				}
+			}
+			
+			// a file replaced by a rename is a new file, its descriptor still points to the previous one
+			for( const auto &path : changed ) {
+				for( auto it = mFiles.begin(); it != mFiles.end(); ++it ) {
+					if( it->second == path ) {
+						close( it->first );
+						mFiles.erase( it );
+						break;
+					}
+				}
+				int fd = addVnode( path );
+				if( fd >= 0 ) {
+					mFiles[fd] = path;
+				}
+				mModificationTimes[path] = getModificationTime( path );
+			}
+		}
+		if( ! changed.empty() ) {
+			dispatch( changed );
+		}
+	}
+#else
+	std::unique_lock<std::mutex> lock( mMutex );
+	while( ! mQuit ) {
+		mCondition.wait_for( lock, std::chrono::milliseconds( 100 ) );
+		if( mQuit ) {
+			break;
+		}
+		std::set<std::string> changed;
+		for( auto &modificationTime : mModificationTimes ) {
+			int64_t time = getModificationTime( modificationTime.first );
+			if( time != modificationTime.second ) {
+				modificationTime.second = time;
+				changed.insert( modificationTime.first );
+			}
+		}
+		if( ! changed.empty() ) {
+			lock.unlock();
+			dispatch( changed );
+			lock.lock();
+		}
+	}
+#endif
+}
+
+} // namespace runtime
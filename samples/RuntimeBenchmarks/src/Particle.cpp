@@ -0,0 +1,19 @@
+#include "Particle.h"
+#include "cinder/Rand.h"
+
+using namespace std;
+using namespace ci;
+
+Particle::Particle()
+: mPosition( randVec3() ), mVelocity( randVec3() * 0.1f ), mAge( 0.0f )
+{
+}
+void Particle::update( float dt )
+{
+	// enough work per instance for the batches of parallelForEach to be worth spreading
+	for( int i = 0; i < 16; ++i ) {
+		mVelocity += ( -mPosition * 0.01f + vec3( sin( mAge ), cos( mAge ), 0.0f ) * 0.001f ) * dt;
+		mPosition += mVelocity * dt;
+		mAge += dt;
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "cinder/Vector.h"
+
+class Particle {
+public:
+	Particle();
+
+	// methods that needs to be modified at runtime have be virtual
+	virtual void update( float dt );
+
+protected:
+	ci::vec3 mPosition, mVelocity;
+	float mAge;
+};
\ No newline at end of file
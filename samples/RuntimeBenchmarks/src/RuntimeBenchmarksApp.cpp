@@ -0,0 +1,304 @@
+#include "cinder/app/App.h"
+#include "cinder/app/RendererGl.h"
+#include "cinder/gl/gl.h"
+#include "cinder/Log.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <thread>
+#if ! defined( CINDER_MSW )
+#include <sys/resource.h>
+#endif
+
+#include "runtime_ptr.h"
+#include "Particle.h"
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+// Measures the overhead of the runtime library against plain C++ equivalents. Each benchmark
+// runs once in setup, the results are logged and drawn in the window
+class RuntimeBenchmarksApp : public App {
+public:
+	void setup() override;
+	void draw() override;
+
+	// returns the fastest of runs calls to fn in milliseconds
+	template<class Fn>
+	static double measure( size_t runs, const Fn &fn );
+	void addResult( const string &name, const vector<pair<string,double>> &timings, const string &unit = "ms" );
+
+	void benchmarkVectorGrowth();
+	void benchmarkRegistry();
+	void benchmarkParallelForEach();
+	void benchmarkWatchers();
+	void benchmarkSourceAssembler();
+
+	vector<string> mResults;
+};
+
+void RuntimeBenchmarksApp::setup()
+{
+	benchmarkVectorGrowth();
+	benchmarkRegistry();
+	benchmarkParallelForEach();
+	benchmarkWatchers();
+	benchmarkSourceAssembler();
+}
+
+void RuntimeBenchmarksApp::draw()
+{
+	gl::clear( Color::gray( 0.1f ) );
+
+	vec2 position( 20.0f );
+	for( const auto &result : mResults ) {
+		gl::drawString( result, position );
+		position.y += 16.0f;
+	}
+}
+
+template<class Fn>
+double RuntimeBenchmarksApp::measure( size_t runs, const Fn &fn )
+{
+	double best = numeric_limits<double>::max();
+	for( size_t i = 0; i < runs; ++i ) {
+		auto start = chrono::steady_clock::now();
+		fn();
+		best = std::min( best, chrono::duration<double,milli>( chrono::steady_clock::now() - start ).count() );
+	}
+	return best;
+}
+
+void RuntimeBenchmarksApp::addResult( const string &name, const vector<pair<string,double>> &timings, const string &unit )
+{
+	stringstream result;
+	result << name << ":" << fixed << setprecision( 3 );
+	for( size_t i = 0; i < timings.size(); ++i ) {
+		result << ( i ? ", " : " " ) << timings[i].first << " " << timings[i].second << unit;
+	}
+	CI_LOG_I( result.str() );
+	mResults.push_back( result.str() );
+}
+
+void RuntimeBenchmarksApp::benchmarkVectorGrowth()
+{
+	// copies, moves and destructions of runtime_ptrs only update the intrusive list of the class,
+	// so a growing vector should cost about the same as with shared_ptrs
+	const size_t count = 100000;
+	auto shared = make_shared<Particle>();
+	auto runtime = make_runtime<Particle>();
+	double sharedDuration = measure( 10, [&]() {
+		vector<shared_ptr<Particle>> ptrs;
+		for( size_t i = 0; i < count; ++i ) {
+			ptrs.push_back( shared );
+		}
+	} );
+	double runtimeDuration = measure( 10, [&]() {
+		vector<runtime_ptr<Particle>> ptrs;
+		for( size_t i = 0; i < count; ++i ) {
+			ptrs.push_back( runtime );
+		}
+	} );
+	addResult( "Vector growth, 100k pointers", { { "shared_ptr", sharedDuration }, { "runtime_ptr", runtimeDuration } } );
+}
+
+void RuntimeBenchmarksApp::benchmarkRegistry()
+{
+	// registering and unregistering a pointer links and unlinks it without any allocation, the
+	// storage of the pointers is reserved up front so only the registry is measured
+	const size_t count = 100000;
+	auto runtime = make_runtime<Particle>();
+	vector<runtime_ptr<Particle>> ptrs;
+	ptrs.reserve( count );
+	double registerDuration = numeric_limits<double>::max();
+	double unregisterDuration = numeric_limits<double>::max();
+	for( size_t run = 0; run < 10; ++run ) {
+		registerDuration = std::min( registerDuration, measure( 1, [&]() {
+			for( size_t i = 0; i < count; ++i ) {
+				ptrs.push_back( runtime );
+			}
+		} ) );
+		unregisterDuration = std::min( unregisterDuration, measure( 1, [&]() {
+			ptrs.clear();
+		} ) );
+	}
+	addResult( "Registry, 100k pointers", { { "register", registerDuration }, { "unregister", unregisterDuration } } );
+}
+
+void RuntimeBenchmarksApp::benchmarkParallelForEach()
+{
+	// updates 100k instances with an increasing number of threads, the calling thread always takes part
+	vector<runtime_ptr<Particle>> particles;
+	for( size_t i = 0; i < 100000; ++i ) {
+		particles.push_back( make_runtime<Particle>() );
+	}
+	auto &pool = runtime::TaskPool::get();
+	size_t maxThreads = pool.getMaxThreads();
+	vector<pair<string,double>> timings;
+	for( size_t numThreads = 0; numThreads <= pool.getNumThreads(); ++numThreads ) {
+		pool.setMaxThreads( numThreads );
+		double duration = measure( 10, []() {
+			runtime_class<Particle>::parallelForEach( []( Particle &particle ) { particle.update( 0.016f ); }, 256 );
+		} );
+		timings.push_back( { to_string( numThreads + 1 ) + ( numThreads ? " threads" : " thread" ), duration } );
+	}
+	pool.setMaxThreads( maxThreads );
+	addResult( "parallelForEach, 100k instances", timings );
+}
+
+// Polls the modification time of every file from a single thread, which is how the runtime classes found out about
+// changes with the Watchdog block before WatchService. Reproduced here so the sample doesn't depend on the block
+class PollingWatcher {
+public:
+	PollingWatcher( const vector<fs::path> &paths, const function<void()> &callback );
+	~PollingWatcher();
+
+protected:
+	vector<pair<fs::path,time_t>>	mFiles;
+	function<void()>				mCallback;
+	atomic<bool>					mQuit;
+	thread							mThread;
+};
+
+PollingWatcher::PollingWatcher( const vector<fs::path> &paths, const function<void()> &callback )
+: mCallback( callback ), mQuit( false )
+{
+	for( const auto &path : paths ) {
+		mFiles.push_back( { path, fs::last_write_time( path ) } );
+	}
+	mThread = thread( [this]() {
+		while( ! mQuit ) {
+			for( auto &file : mFiles ) {
+				time_t time = fs::last_write_time( file.first );
+				if( time != file.second ) {
+					file.second = time;
+					mCallback();
+				}
+			}
+			this_thread::sleep_for( chrono::milliseconds( 100 ) );
+		}
+	} );
+}
+
+PollingWatcher::~PollingWatcher()
+{
+	mQuit = true;
+	mThread.join();
+}
+
+void RuntimeBenchmarksApp::benchmarkWatchers()
+{
+	// the same 200 files are watched by the runtime WatchService and by the timestamp polling it replaced
+	fs::path directory = fs::temp_directory_path() / "RuntimeBenchmarks";
+	fs::create_directories( directory );
+	vector<fs::path> files;
+	for( size_t i = 0; i < 200; ++i ) {
+		files.push_back( directory / ( "File" + to_string( i ) + ".h" ) );
+		ofstream( files.back().c_str() ) << i;
+	}
+	
+	// time from the modification of the file to its callback, the files are modified a second apart as the modification
+	// times of the polling watcher have a resolution of a second, with an offset so they don't always land at the same point of its interval
+	atomic<int64_t> received( 0 );
+	auto now = []() { return chrono::duration_cast<chrono::microseconds>( chrono::steady_clock::now().time_since_epoch() ).count(); };
+	auto onChange = [&received,now]() { received = now(); };
+	auto measureLatency = [&]() {
+		double sum = 0.0;
+		size_t count = 5;
+		for( size_t i = 0; i < count; ++i ) {
+			this_thread::sleep_for( chrono::milliseconds( 1100 + 23 * i ) );
+			received = 0;
+			int64_t start = now();
+			ofstream( files[i].c_str() ) << "modified " << start;
+			while( ! received && now() - start < 5000000 ) {
+				this_thread::sleep_for( chrono::microseconds( 100 ) );
+			}
+			sum += received ? ( received - start ) / 1000.0 : 5000.0;
+		}
+		return sum / count;
+	};
+	
+	// CPU time the process spends while the app sleeps, mostly in the watch threads
+	auto measureIdleCpu = []() {
+#if ! defined( CINDER_MSW )
+		auto getCpuTime = []() {
+			rusage usage;
+			getrusage( RUSAGE_SELF, &usage );
+			return ( usage.ru_utime.tv_sec + usage.ru_stime.tv_sec ) * 1000.0 + ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1000.0;
+		};
+		double start = getCpuTime();
+		this_thread::sleep_for( chrono::seconds( 2 ) );
+		return ( getCpuTime() - start ) / 2.0;
+#else
+		return 0.0;
+#endif
+	};
+	
+	size_t id = runtime::WatchService::get().watch( files, [onChange]( const vector<fs::path>& ) { onChange(); } );
+	double serviceLatency = measureLatency();
+	double serviceCpu = measureIdleCpu();
+	runtime::WatchService::get().unwatch( id );
+	
+	double pollingLatency, pollingCpu;
+	{
+		PollingWatcher watcher( files, onChange );
+		pollingLatency = measureLatency();
+		pollingCpu = measureIdleCpu();
+	}
+	
+	addResult( "Watch latency, 200 files", { { "WatchService", serviceLatency }, { "polling", pollingLatency } } );
+	addResult( "Idle CPU time per second, 200 files", { { "WatchService", serviceCpu }, { "polling", pollingCpu } } );
+	fs::remove_all( directory );
+}
+
+void RuntimeBenchmarksApp::benchmarkSourceAssembler()
+{
+	// a 10k lines translation unit with its includes at the top and a few commented out ones
+	fs::path path = fs::temp_directory_path() / "RuntimeBenchmarksSource.cpp";
+	{
+		ofstream file( path.c_str() );
+		for( size_t i = 0; i < 20; ++i ) {
+			file << "#include \"Header" << i << ".h\"\n";
+		}
+		for( size_t i = 0; file && i < 9980 / 5; ++i ) {
+			file << "// #include \"Commented" << i << ".h\"\n";
+			file << "int function" << i << "( int value )\n";
+			file << "{\n";
+			file << "\treturn value * " << i << " + 1;\n";
+			file << "}\n";
+		}
+	}
+	
+	// the line by line loop the runtime classes and apps used before SourceAssembler
+	auto getlineDuration = measure( 10, [&path]() {
+		ifstream file( path.c_str() );
+		string line, includes, code;
+		while( getline( file, line ) ) {
+			if( line.find( "#include" ) != string::npos ) {
+				includes += line + "\n";
+			}
+			else {
+				code += line + " \n";
+			}
+		}
+	} );
+	auto splitDuration = measure( 10, [&path]() {
+		runtime::SourceChunk chunk;
+		runtime::SourceAssembler::split( runtime::readFile( path ), string(), string(), &chunk );
+	} );
+	// the chunk of a file that didn't change since the last reload is reused
+	runtime::SourceAssembler::get().getChunk( path );
+	auto cachedDuration = measure( 10, [&path]() {
+		runtime::SourceAssembler::get().getChunk( path );
+	} );
+	addResult( "Source assembly, 10k lines", { { "getline", getlineDuration }, { "SourceAssembler", splitDuration }, { "SourceAssembler unchanged", cachedDuration } } );
+	fs::remove( path );
+}
+
+CINDER_APP( RuntimeBenchmarksApp, RendererGl )
@@ -37,7 +37,8 @@ void RuntimePointerCerealsApp::setup()
 #endif
 	
 	// create the runtime pointers
-	// try to save ObjectA.cpp and ObjectB.cpp at runtime, you'll see that mObjB will restart its rotation at 0.0 everytime because it doesn't support serialization.
+	// try to save ObjectA.cpp and ObjectB.cpp at runtime, mObjB doesn't support serialization but keeps its rotation as long as mRotation keeps the same name and type.
+	// Rename it and mObjB will restart its rotation at 0.0.
 	// On the other hand mObjA will restore its previous state every time including the modifications done with its UI
 	mObjA = make_runtime<ObjectA>();
 	mObjB = make_runtime<ObjectB>();